@@ -0,0 +1,366 @@
+//
+//  AutoTuner.cpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#include "AutoTuner.hpp"
+#include "BatchedErrors.hpp"
+#include "Image.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <cstdio>
+#include <unistd.h>
+
+// Size of the random image calibration scans, and the block and border sizes it scans it with
+static const int calibrationSize = 512;
+static const int calibrationBlock = 32;
+static const int calibrationBorder = 6;
+// Each measurement is repeated until it has taken this many milliseconds
+static const double calibrationMs = 20;
+// Scans are split into chunks of at least this many nanoseconds of work, so taking a chunk costs little in comparison
+static const double chunkNs = 20000;
+// Chunks per thread, so threads that finish early can take over from slower ones
+static const int chunksPerThread = 8;
+// Passes a PatchMatch search makes, as in Texture, and the random blocks a position starts from, as in SourceImage
+static const int patchMatchPasses = 4;
+static const int patchMatchStarts = 4;
+// PatchMatch is only chosen when exact search is predicted to take this long, and this many times as long
+static const double approximateAfterMs = 1000;
+static const double approximateRatio = 10;
+static const char *modelHeader = "image-quilting-tuning 1";
+
+static const char *metricNames[3] = {"magnitude", "squared", "luminance"};
+static const char *layoutNames[3] = {"packed", "rgbx", "planar"};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Nanoseconds per call of work, run until calibrationMs have passed
+template <typename Work>
+static double timeNs(Work work) {
+    auto start = std::chrono::steady_clock::now();
+    long calls = 0;
+    do {
+        work();
+        calls++;
+    } while (secondsSince(start) * 1000 < calibrationMs);
+    return secondsSince(start) * 1e9 / calls;
+}
+
+// Pixels a scan compares for each block: the overlaps of a block matched on both sides, and for transfer the whole block
+static double pixelsCompared(GLsizei blockSize, GLsizei borderSize, bool transfer) {
+    double overlap = 2.0 * blockSize * borderSize - borderSize * borderSize;
+    return transfer ? overlap + blockSize * blockSize : overlap;
+}
+
+std::string defaultTuningPath() {
+    const char *home = getenv("HOME");
+    return std::string(home != NULL ? home : ".") + "/.image_quilting_tuning";
+}
+
+CostModel calibrateCostModel() {
+    CostModel model;
+    std::cout << "Calibrating the auto-tuner...\n";
+    // Its own random numbers, so calibrating doesn't change the blocks rand() picks afterwards
+    std::minstd_rand random;
+    
+    std::vector<GLubyte> pixels(calibrationSize * calibrationSize * 3);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = random() % 256;
+    std::vector<int> targetLuminance(calibrationBlock * calibrationBlock);
+    for (size_t i = 0; i < targetLuminance.size(); i++)
+        targetLuminance[i] = random() % 256;
+    
+    GLint step = calibrationBlock - calibrationBorder;
+    GLint numCols = (calibrationSize - calibrationBlock) / step + 1;
+    GLint numBlocks = numCols * numCols;
+    std::vector<long long> errors(numBlocks);
+    
+    // Every scan kernel, in every layout
+    for (int layout = 0; layout < 3; layout++) {
+        Image image(calibrationSize, calibrationSize);
+        image.writePixels(0, 0, calibrationSize, calibrationSize, pixels.data());
+        if (layout != PackedRGB)
+            image.convertLayout((PixelLayout)layout);
+        ImageView view = image.view();
+        
+        ScanInput input;
+        input.image = view.data;
+        input.rowLength = view.stride;
+        input.channelStride = view.channelStride;
+        input.numCols = numCols;
+        input.numBlocks = numBlocks;
+        input.step = step;
+        input.blockSize = calibrationBlock;
+        input.borderSize = calibrationBorder;
+        input.leftBorder = view.subView(step, 0, calibrationBorder, calibrationBlock);
+        input.bottomBorder = view.subView(0, step, calibrationBlock, calibrationBorder);
+        input.candidates = NULL;
+        input.firstBlock = 0;
+        for (int transfer = 0; transfer < 2; transfer++) {
+            input.targetLuminance = transfer ? targetLuminance.data() : NULL;
+            for (int metric = 0; metric < 3; metric++) {
+                ScanKernel kernel = selectScanKernel(Both, transfer, (ErrorMetric)metric, (PixelLayout)layout, calibrationBlock, calibrationBorder);
+                double ns = timeNs([&] { kernel(input, errors.data()); });
+                model.scanCost[transfer][metric][layout] = ns / (numBlocks * pixelsCompared(calibrationBlock, calibrationBorder, transfer));
+            }
+        }
+        
+        // How well a scan splits over every core, measured on the packed image while it is around
+        if (layout == PackedRGB) {
+            model.hardwareThreads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+            model.parallelEfficiency = 1;
+            if (model.hardwareThreads > 1) {
+                ScanKernel kernel = selectScanKernel(Both, false, Magnitude, PackedRGB, calibrationBlock, calibrationBorder);
+                input.targetLuminance = NULL;
+                double serial = timeNs([&] { kernel(input, errors.data()); });
+                int threads = model.hardwareThreads;
+                double parallel = timeNs([&] {
+                    std::vector<std::thread> workers;
+                    for (int t = 0; t < threads; t++) {
+                        workers.push_back(std::thread([&, t] {
+                            ScanInput part = input;
+                            part.firstBlock = numBlocks * t / threads;
+                            part.numBlocks = numBlocks * (t + 1) / threads - part.firstBlock;
+                            kernel(part, errors.data() + part.firstBlock);
+                        }));
+                    }
+                    for (int t = 0; t < threads; t++)
+                        workers[t].join();
+                });
+                model.parallelEfficiency = fmin(1, fmax(0.05, serial / (parallel * threads)));
+            }
+        }
+    }
+    
+    // Batched errors: the left strips of 64 blocks against those of every block
+    Image image(calibrationSize, calibrationSize);
+    image.writePixels(0, 0, calibrationSize, calibrationSize, pixels.data());
+    StripMatrix strips(image.view(), numCols, numBlocks, step, calibrationBlock, calibrationBorder, LeftStrip);
+    int rows = 64;
+    std::vector<GLint> products((size_t)rows * numBlocks);
+    double productNs = timeNs([&] { crossProducts(strips.strip(0), rows, strips.strip(0), numBlocks, strips.length, products.data()); });
+    model.productCost = productNs / ((double)rows * numBlocks * strips.length);
+    
+    // Seams: finding the cut through an overlap, on top of the errors a scan would compute for it
+    std::vector<int> overlapErrors(calibrationBlock * calibrationBorder);
+    for (size_t i = 0; i < overlapErrors.size(); i++)
+        overlapErrors[i] = random() % 1000;
+    std::vector<GLubyte> path(calibrationBlock);
+    double cutNs = timeNs([&] { minimumErrorCut(overlapErrors.data(), calibrationBlock, calibrationBorder, path.data()); });
+    model.seamCost = cutNs / overlapErrors.size() + model.scanCost[0][Magnitude][PackedRGB];
+    
+    model.threadCost = timeNs([] { std::thread([] {}).join(); }) / 1000;
+    return model;
+}
+
+bool saveCostModel(const CostModel &model, const std::string &path) {
+    // Written to a file of this process's own and renamed into place, so processes saving at once never
+    // leave a mix of their models, and readers never see half of one
+    std::ostringstream tmpPath;
+    tmpPath << path << "." << getpid() << ".tmp";
+    std::ofstream file(tmpPath.str().c_str());
+    file << modelHeader << "\n";
+    file << "hardware-threads " << model.hardwareThreads << "\n";
+    file << "parallel-efficiency " << model.parallelEfficiency << "\n";
+    file << "thread-us " << model.threadCost << "\n";
+    file << "product-ns " << model.productCost << "\n";
+    file << "seam-ns " << model.seamCost << "\n";
+    for (int transfer = 0; transfer < 2; transfer++) {
+        for (int metric = 0; metric < 3; metric++) {
+            for (int layout = 0; layout < 3; layout++)
+                file << "scan-ns " << (transfer ? "transfer " : "synthesis ") << metricNames[metric] << " " << layoutNames[layout] << " " << model.scanCost[transfer][metric][layout] << "\n";
+        }
+    }
+    file.close();
+    if (file.fail() || rename(tmpPath.str().c_str(), path.c_str()) != 0) {
+        unlink(tmpPath.str().c_str());
+        std::cout << path << " cannot be written.\n";
+        return false;
+    }
+    return true;
+}
+
+bool loadCostModel(CostModel &model, const std::string &path) {
+    std::ifstream file(path.c_str());
+    std::string line;
+    if (!std::getline(file, line) || line != modelHeader)
+        return false;
+    
+    // Every value must be there, so a model from an older version is measured again
+    int found = 0;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        fields >> key;
+        if (key == "scan-ns") {
+            std::string kind, metric, layout;
+            double cost;
+            fields >> kind >> metric >> layout >> cost;
+            for (int m = 0; m < 3; m++) {
+                for (int l = 0; l < 3; l++) {
+                    if (!fields.fail() && metric == metricNames[m] && layout == layoutNames[l]) {
+                        model.scanCost[kind == "transfer"][m][l] = cost;
+                        found++;
+                    }
+                }
+            }
+        }
+        else if (key == "hardware-threads" && fields >> model.hardwareThreads)
+            found++;
+        else if (key == "parallel-efficiency" && fields >> model.parallelEfficiency)
+            found++;
+        else if (key == "thread-us" && fields >> model.threadCost)
+            found++;
+        else if (key == "product-ns" && fields >> model.productCost)
+            found++;
+        else if (key == "seam-ns" && fields >> model.seamCost)
+            found++;
+    }
+    int cores = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+    return found == 2 * 3 * 3 + 5 && model.hardwareThreads == cores;
+}
+
+CostModel loadOrCalibrate(const std::string &tuningPath) {
+    // Jobs on a server share the model, so only the first of them calibrates
+    static std::mutex calibrateMutex;
+    std::lock_guard<std::mutex> lock(calibrateMutex);
+    std::string path = tuningPath.empty() ? defaultTuningPath() : tuningPath;
+    
+    CostModel model;
+    if (loadCostModel(model, path))
+        return model;
+    model = calibrateCostModel();
+    if (saveCostModel(model, path))
+        std::cout << "Saved the auto-tuner's measurements to " << path << "\n";
+    return model;
+}
+
+void printCostModel(const CostModel &model) {
+    std::cout << "Cores: " << model.hardwareThreads << ", keeping " << (int)(model.parallelEfficiency * 100) << "% of their speed in parallel scans\n";
+    std::cout << "Starting a thread: " << model.threadCost << " us\n";
+    std::cout << "Batched errors: " << model.productCost << " ns per multiply-add\n";
+    std::cout << "Seams: " << model.seamCost << " ns per pixel\n";
+    for (int transfer = 0; transfer < 2; transfer++) {
+        std::cout << (transfer ? "Transfer" : "Synthesis") << " scans, ns per pixel:";
+        for (int metric = 0; metric < 3; metric++) {
+            std::cout << "\n  " << metricNames[metric] << ":";
+            for (int layout = 0; layout < 3; layout++)
+                std::cout << " " << layoutNames[layout] << " " << model.scanCost[transfer][metric][layout];
+        }
+        std::cout << "\n";
+    }
+}
+
+// Share of a thread's speed a scan split over threads threads keeps, from the efficiency measured over every core
+static double efficiency(const CostModel &model, int threads) {
+    if (model.hardwareThreads <= 1)
+        return 1;
+    return 1 - (1 - model.parallelEfficiency) * (threads - 1) / (model.hardwareThreads - 1);
+}
+
+// A way of generating the texture and its predicted milliseconds
+struct TuningOption {
+    std::string name;
+    double predicted;
+    bool batched;
+    int threads;
+};
+
+TuningChoice tuneTexture(const CostModel &model, SourceImage *source, Texture *texture, int maxThreads) {
+    Image *target = texture->getTargetImage();
+    bool transfer = target != NULL;
+    double placements = (double)texture->getCols() * texture->getRows();
+    double blocks = source->getNumBlocks();
+    double pixels = pixelsCompared(source->blockSize, source->borderSize, transfer);
+    double pixelCost = model.scanCost[transfer][source->getErrorMetric()][source->getPixelLayout()];
+    double seams = placements * model.seamCost * pixelsCompared(source->blockSize, source->borderSize, false);
+    
+    // Exact search: a scan of every block per placement, split over 1, 2, 4... threads up to what the machine has
+    std::vector<TuningOption> options;
+    int threadLimit = maxThreads < model.hardwareThreads ? maxThreads : model.hardwareThreads;
+    for (int threads = 1; ; threads *= 2) {
+        threads = threads < threadLimit ? threads : threadLimit;
+        double ns = placements * (blocks * pixels * pixelCost / (threads * efficiency(model, threads)) + (threads - 1) * model.threadCost * 1000) + seams;
+        std::ostringstream name;
+        name << "scanning on " << threads << (threads == 1 ? " thread" : " threads");
+        TuningOption option = {name.str(), ns / 1e6, false, threads};
+        options.push_back(option);
+        if (threads == threadLimit)
+            break;
+    }
+    // Batched errors multiply three channel values per overlap pixel with every block, on one thread
+    if (source->batchesErrors(target)) {
+        double ns = placements * blocks * pixelsCompared(source->blockSize, source->borderSize, false) * 3 * model.productCost + seams;
+        TuningOption option = {"batched", ns / 1e6, true, 1};
+        options.push_back(option);
+    }
+    size_t best = 0;
+    for (size_t i = 1; i < options.size(); i++) {
+        if (options[i].predicted < options[best].predicted)
+            best = i;
+    }
+    
+    TuningChoice choice;
+    choice.search = ExhaustiveSearch;
+    choice.batched = options[best].batched;
+    choice.threads = options[best].threads;
+    choice.predicted = options[best].predicted;
+    int chunk = (int)ceil(chunkNs / (pixels * pixelCost));
+    int balanced = (int)ceil(blocks / (choice.threads * chunksPerThread));
+    choice.chunkBlocks = chunk > balanced ? chunk : balanced;
+    
+    // PatchMatch tries its random starts, the blocks continuing up to four neighbours and a random block
+    // at each of the halving distances across the source, for every placement on every pass
+    double candidates = patchMatchStarts + 4 + log2(fmax(2, sqrt(blocks)));
+    TuningOption approximate = {"patchmatch", (patchMatchPasses * placements * candidates * pixels * pixelCost + seams) / 1e6, false, 1};
+    options.push_back(approximate);
+    if (choice.predicted > approximateAfterMs && choice.predicted > approximateRatio * approximate.predicted) {
+        best = options.size() - 1;
+        choice.search = PatchMatchSearch;
+        choice.batched = false;
+        choice.threads = 1;
+        choice.predicted = approximate.predicted;
+    }
+    
+    std::ostringstream alternatives;
+    for (size_t i = 0; i < options.size(); i++) {
+        if (i != best)
+            alternatives << (alternatives.tellp() > 0 ? ", " : "") << options[i].name << " " << (long long)options[i].predicted << " ms";
+    }
+    choice.alternatives = alternatives.str();
+    return choice;
+}
+
+void applyTuning(const TuningChoice &choice, SourceImage *source, Texture *texture) {
+    texture->setSearch(choice.search);
+    source->setBatched(choice.batched);
+    source->setThreads(choice.threads, choice.chunkBlocks);
+    std::cout << describeTuning(choice) << "\n";
+}
+
+std::string describeTuning(const TuningChoice &choice) {
+    std::ostringstream line;
+    line << "Auto-tuner: ";
+    if (choice.search == PatchMatchSearch)
+        line << "patchmatch search";
+    else if (choice.batched)
+        line << "exhaustive search with batched errors";
+    else if (choice.threads > 1)
+        line << "exhaustive search on " << choice.threads << " threads in chunks of " << choice.chunkBlocks << " blocks";
+    else
+        line << "exhaustive search on 1 thread";
+    line << ", predicted " << (int)choice.predicted << " ms (" << choice.alternatives << ")";
+    return line.str();
+}
@@ -0,0 +1,62 @@
+//
+//  AutoTuner.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef AutoTuner_hpp
+#define AutoTuner_hpp
+
+#include <stdio.h>
+#include <string>
+#include "ErrorKernels.hpp"
+#include "SourceImage.hpp"
+#include "Texture.hpp"
+
+// How fast this machine runs each part of a search, measured once by calibrateCostModel
+struct CostModel {
+    // Nanoseconds per pixel compared by a scan, [transfer][metric][layout]
+    double scanCost[2][3][3];
+    // Nanoseconds per multiply-add of crossProducts, for batched errors
+    double productCost;
+    // Nanoseconds per overlap pixel for cutting a seam through it
+    double seamCost;
+    // Microseconds to start and join a thread
+    double threadCost;
+    // Cores, and how much of their speed a scan split over all of them keeps
+    int hardwareThreads;
+    double parallelEfficiency;
+};
+
+// How to generate a texture, as chosen by tuneTexture
+struct TuningChoice {
+    SearchStrategy search;
+    bool batched;
+    int threads, chunkBlocks;
+    double predicted;           // milliseconds
+    std::string alternatives;   // the other options considered and their predictions, for the log
+};
+
+// Where the cost model is kept unless --tuning says otherwise: ~/.image_quilting_tuning
+std::string defaultTuningPath();
+
+// Time the scan kernels, matrix products, seams and threads on a random image
+CostModel calibrateCostModel();
+bool saveCostModel(const CostModel &model, const std::string &path);
+// Returns false if there is no model at path, or it was measured on a machine with a different number of cores
+bool loadCostModel(CostModel &model, const std::string &path);
+// Load the model at path (the default path if empty), calibrating and saving one first if there is none
+CostModel loadOrCalibrate(const std::string &path);
+void printCostModel(const CostModel &model);
+
+// Predict how long each way of generating texture from source would take and choose the fastest:
+// an exhaustive scan on 1 to maxThreads threads, batched errors if the source can use them,
+// or PatchMatch when exact search is predicted to take over a second and ten times as long
+TuningChoice tuneTexture(const CostModel &model, SourceImage *source, Texture *texture, int maxThreads);
+// Set up source and texture as choice says and log it
+void applyTuning(const TuningChoice &choice, SourceImage *source, Texture *texture);
+// The line applyTuning logs for choice, without the newline
+std::string describeTuning(const TuningChoice &choice);
+
+#endif /* AutoTuner_hpp */
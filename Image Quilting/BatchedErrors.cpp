@@ -0,0 +1,101 @@
+//
+//  BatchedErrors.cpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#include "BatchedErrors.hpp"
+#include <cstring>
+
+// Rows of b and values per row multiplied at once, so the tile of b (64 KB) stays in cache for every row of a
+static const int tileRows = 64;
+static const int tileLength = 512;
+
+StripMatrix::StripMatrix(const ImageView &source, GLint numCols, GLint numBlocks, GLint step, GLsizei blockSize, GLsizei borderSize, StripSide side) {
+    int w = side == LeftStrip || side == RightStrip ? borderSize : blockSize;
+    int h = side == LeftStrip || side == RightStrip ? blockSize : borderSize;
+    int x0 = side == RightStrip ? step : 0;
+    int y0 = side == TopStrip ? step : 0;
+    length = (w * h * 3 + crossChunk - 1) / crossChunk * crossChunk;
+    count = numBlocks;
+    values.resize((size_t)numBlocks * length, 0);
+    norms.resize(numBlocks);
+    
+    // Strips are stored in raster order, like the borders the scan kernels compare
+    for (GLint i = 0; i < numBlocks; i++) {
+        GLshort *row = &values[(size_t)i * length];
+        ImageView block = source.subView((i % numCols) * step + x0, (i / numCols) * step + y0, w, h);
+        long long norm = 0;
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                GLubyte pixel[3];
+                block.readPixel(x, y, EdgeClamp, pixel);
+                for (int c = 0; c < 3; c++) {
+                    *row++ = pixel[c];
+                    norm += pixel[c] * pixel[c];
+                }
+            }
+        }
+        norms[i] = norm;
+    }
+}
+
+StripSide facingSide(StripSide side) {
+    switch (side) {
+        case LeftStrip: return RightStrip;
+        case BottomStrip: return TopStrip;
+        case RightStrip: return LeftStrip;
+        default: return BottomStrip;
+    }
+}
+
+// Add the dot products of 4 rows of a with 4 rows of b over [0, n) to sums, the register tile of the product
+// n is a multiple of crossChunk, so the inner loop has a fixed length that compilers vectorize completely
+static inline void crossTile(const GLshort *a[4], const GLshort *b[4], int n, GLint sums[4][4]) {
+    GLint s00 = 0, s01 = 0, s02 = 0, s03 = 0, s10 = 0, s11 = 0, s12 = 0, s13 = 0;
+    GLint s20 = 0, s21 = 0, s22 = 0, s23 = 0, s30 = 0, s31 = 0, s32 = 0, s33 = 0;
+    const GLshort *a0 = a[0], *a1 = a[1], *a2 = a[2], *a3 = a[3];
+    const GLshort *b0 = b[0], *b1 = b[1], *b2 = b[2], *b3 = b[3];
+    for (int k0 = 0; k0 < n; k0 += crossChunk) {
+        for (int k = k0; k < k0 + crossChunk; k++) {
+            s00 += a0[k] * b0[k]; s01 += a0[k] * b1[k]; s02 += a0[k] * b2[k]; s03 += a0[k] * b3[k];
+            s10 += a1[k] * b0[k]; s11 += a1[k] * b1[k]; s12 += a1[k] * b2[k]; s13 += a1[k] * b3[k];
+            s20 += a2[k] * b0[k]; s21 += a2[k] * b1[k]; s22 += a2[k] * b2[k]; s23 += a2[k] * b3[k];
+            s30 += a3[k] * b0[k]; s31 += a3[k] * b1[k]; s32 += a3[k] * b2[k]; s33 += a3[k] * b3[k];
+        }
+    }
+    sums[0][0] += s00; sums[0][1] += s01; sums[0][2] += s02; sums[0][3] += s03;
+    sums[1][0] += s10; sums[1][1] += s11; sums[1][2] += s12; sums[1][3] += s13;
+    sums[2][0] += s20; sums[2][1] += s21; sums[2][2] += s22; sums[2][3] += s23;
+    sums[3][0] += s30; sums[3][1] += s31; sums[3][2] += s32; sums[3][3] += s33;
+}
+
+void crossProducts(const GLshort *a, int numA, const GLshort *b, int numB, int length, GLint *products) {
+    memset(products, 0, sizeof(GLint) * numA * numB);
+    
+    for (int j0 = 0; j0 < numB; j0 += tileRows) {
+        int j1 = j0 + tileRows < numB ? j0 + tileRows : numB;
+        for (int k0 = 0; k0 < length; k0 += tileLength) {
+            int n = k0 + tileLength < length ? tileLength : length - k0;
+            
+            // 4 x 4 register tiles; rows past the end of a or b repeat the last row and their sums are dropped
+            for (int i = 0; i < numA; i += 4) {
+                const GLshort *rowsA[4];
+                for (int t = 0; t < 4; t++)
+                    rowsA[t] = a + (size_t)(i + t < numA ? i + t : numA - 1) * length + k0;
+                for (int j = j0; j < j1; j += 4) {
+                    const GLshort *rowsB[4];
+                    for (int t = 0; t < 4; t++)
+                        rowsB[t] = b + (size_t)(j + t < j1 ? j + t : j1 - 1) * length + k0;
+                    GLint sums[4][4] = {};
+                    crossTile(rowsA, rowsB, n, sums);
+                    for (int ti = 0; ti < 4 && i + ti < numA; ti++) {
+                        for (int tj = 0; tj < 4 && j + tj < j1; tj++)
+                            products[(size_t)(i + ti) * numB + j + tj] += sums[ti][tj];
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,57 @@
+//
+//  BatchedErrors.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef BatchedErrors_hpp
+#define BatchedErrors_hpp
+
+#include <stdio.h>
+#include <vector>
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include "ImageView.hpp"
+
+// The strips along each side of a block where it overlaps its neighbours
+enum StripSide {
+    LeftStrip,      // borderSize x blockSize
+    BottomStrip,    // blockSize x borderSize
+    RightStrip,     // borderSize x blockSize, the left strip of the block to the right
+    TopStrip        // blockSize x borderSize, the bottom strip of the block above
+};
+
+// Values crossProducts multiplies at a time, which the length of its rows must be a multiple of
+static const int crossChunk = 16;
+
+// The strip on one side of every block of a source image, as the rows of a matrix of channel values
+// The squared error between two strips a and b is |a|^2 + |b|^2 - 2 a.b, so the errors of many positions
+// against every block only need the norms below and one matrix product of the positions' strips with this matrix
+class StripMatrix {
+private:
+    std::vector<GLshort> values;
+    std::vector<long long> norms;
+public:
+    // Read side of each of the numBlocks blocks on a grid numCols wide, step pixels apart, from source
+    StripMatrix(const ImageView &source, GLint numCols, GLint numBlocks, GLint step, GLsizei blockSize, GLsizei borderSize, StripSide side);
+    // Channel values in one strip, padded with zeros to a multiple of crossChunk, and how many strips there are
+    int length, count;
+    const GLshort *strip(GLint index) const { return &values[(size_t)index * length]; }
+    // squared length of strip index
+    long long norm(GLint index) const { return norms[index]; }
+};
+
+// The side of a neighbour that overlaps side of a block
+StripSide facingSide(StripSide side);
+
+// Fill products[i * numB + j] with the dot product of rows i of a and j of b, which are numA and numB rows of length values
+// Blocked so a tile of b stays in cache while every row of a is multiplied with it
+void crossProducts(const GLshort *a, int numA, const GLshort *b, int numB, int length, GLint *products);
+
+#endif /* BatchedErrors_hpp */
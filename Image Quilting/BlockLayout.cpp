@@ -0,0 +1,118 @@
+//
+//  BlockLayout.cpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#include "BlockLayout.hpp"
+#include <iostream>
+#include <cstring>
+
+// Layout files start with this, followed by the version, dimensions, tileability and the two arrays in host byte order
+static const char layoutMagic[8] = {'I', 'Q', 'L', 'A', 'Y', 'O', 'U', 'T'};
+static const GLint layoutVersion = 2;
+// Largest layout load accepts, so a damaged header can't ask for more memory than a texture could use
+static const GLint maxLayoutSide = 1 << 16;
+static const GLsizei maxLayoutBlockSize = 4096;
+
+BlockLayout::BlockLayout() {
+    cols = rows = 0;
+    blockSize = borderSize = 0;
+    tileable = false;
+}
+
+void BlockLayout::resize(GLint c, GLint r, GLsizei blockS, GLsizei borderS) {
+    cols = c;
+    rows = r;
+    blockSize = blockS;
+    borderSize = borderS;
+    sourceIndices.assign((size_t)cols * rows, 0);
+    borderPaths.assign((size_t)cols * rows * 2 * blockSize, 0);
+}
+
+// Write the layout to filename, returns false if it could not be written
+bool BlockLayout::save(const char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        std::cout << filename << " cannot be written.\n";
+        return false;
+    }
+    
+    GLint header[6] = {layoutVersion, cols, rows, blockSize, borderSize, tileable};
+    bool ok = fwrite(layoutMagic, 1, sizeof(layoutMagic), file) == sizeof(layoutMagic) &&
+        fwrite(header, sizeof(GLint), 6, file) == 6 &&
+        fwrite(sourceIndices.data(), sizeof(GLint), sourceIndices.size(), file) == sourceIndices.size() &&
+        fwrite(borderPaths.data(), 1, borderPaths.size(), file) == borderPaths.size();
+    fclose(file);
+    
+    if (!ok)
+        std::cout << filename << " cannot be written.\n";
+    else
+        std::cout << "Saved layout of " << cols * rows << " blocks (" << bytesPerBlock() << " bytes per block) to " << filename << "\n";
+    return ok;
+}
+
+// Read a layout written by save from filename, returns false if it could not be read
+bool BlockLayout::load(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        std::cout << filename << " cannot be read.\n";
+        return false;
+    }
+    
+    char magic[8];
+    GLint header[6];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, layoutMagic, sizeof(magic)) != 0 ||
+        fread(header, sizeof(GLint), 1, file) != 1) {
+        std::cout << filename << " is not a block layout file.\n";
+        fclose(file);
+        return false;
+    }
+    // Version 1 didn't record whether the texture was tileable, so its wrap seams can't be checked
+    if (header[0] != layoutVersion || fread(header + 1, sizeof(GLint), 5, file) != 5) {
+        std::cout << filename << " was saved by an older version and has to be saved again.\n";
+        fclose(file);
+        return false;
+    }
+    
+    GLint c = header[1], r = header[2];
+    GLsizei blockS = header[3], borderS = header[4];
+    if (c < 1 || r < 1 || c > maxLayoutSide || r > maxLayoutSide || borderS < 1 || borderS >= blockS || blockS > maxLayoutBlockSize ||
+        (header[5] != 0 && header[5] != 1)) {
+        std::cout << filename << " has an invalid size.\n";
+        fclose(file);
+        return false;
+    }
+    // The rest of the file must hold exactly the two arrays, checked before making room for them
+    long start = ftell(file);
+    fseek(file, 0, SEEK_END);
+    long long expected = (long long)c * r * (sizeof(GLint) + 2 * blockS);
+    if (ftell(file) - start != expected) {
+        std::cout << filename << " is truncated.\n";
+        fclose(file);
+        return false;
+    }
+    fseek(file, start, SEEK_SET);
+    
+    resize(c, r, blockS, borderS);
+    tileable = header[5] == 1;
+    bool ok = fread(sourceIndices.data(), sizeof(GLint), sourceIndices.size(), file) == sourceIndices.size() &&
+        fread(borderPaths.data(), 1, borderPaths.size(), file) == borderPaths.size();
+    fclose(file);
+    if (!ok) {
+        std::cout << filename << " is truncated.\n";
+        resize(0, 0, 0, 0);
+        return false;
+    }
+    
+    // Border paths are offsets into the border
+    for (size_t i = 0; i < borderPaths.size(); i++) {
+        if (borderPaths[i] >= borderSize) {
+            std::cout << filename << " has a border path outside of the border.\n";
+            resize(0, 0, 0, 0);
+            return false;
+        }
+    }
+    return true;
+}
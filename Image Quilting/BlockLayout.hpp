@@ -0,0 +1,49 @@
+//
+//  BlockLayout.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef BlockLayout_hpp
+#define BlockLayout_hpp
+
+#include <stdio.h>
+#include <vector>
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+// Which source block goes where in a texture, and the border paths between blocks
+// Blocks are stored in placement order (row by row from the bottom left), structure-of-arrays style:
+// one array of source image indices, and one slab with the left then bottom border path of every block
+// Border path offsets are always less than borderSize, so they are stored as single bytes
+class BlockLayout {
+private:
+    std::vector<GLint> sourceIndices;
+    std::vector<GLubyte> borderPaths;
+public:
+    BlockLayout();
+    GLint cols, rows;
+    GLsizei blockSize, borderSize;
+    // whether the last col and row wrap around onto the first, which changes their border paths
+    bool tileable;
+    // clears the layout and makes room for cols * rows blocks
+    void resize(GLint c, GLint r, GLsizei blockS, GLsizei borderS);
+    bool empty() { return sourceIndices.empty(); }
+    GLint &sourceIndex(GLint r, GLint c) { return sourceIndices[r * cols + c]; }
+    GLubyte *borderPathLeft(GLint r, GLint c) { return &borderPaths[(r * cols + c) * 2 * blockSize]; }
+    GLubyte *borderPathBottom(GLint r, GLint c) { return &borderPaths[((r * cols + c) * 2 + 1) * blockSize]; }
+    // position of the block in the texture
+    GLint posX(GLint c) { return c * (blockSize - borderSize); }
+    GLint posY(GLint r) { return r * (blockSize - borderSize); }
+    // number of bytes used per block
+    size_t bytesPerBlock() { return sizeof(GLint) + 2 * blockSize; }
+    bool save(const char *filename);
+    bool load(const char *filename);
+};
+
+#endif /* BlockLayout_hpp */
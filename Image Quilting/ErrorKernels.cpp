@@ -0,0 +1,293 @@
+//
+//  ErrorKernels.cpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#include "ErrorKernels.hpp"
+
+template <ErrorMetric metric>
+static void viewErrors(const ImageView &a, const ImageView &b, int *errors) {
+    // Pixels in other layouts are read back as packed RGB, so a and b need not share a layout
+    GLubyte pixelA[3], pixelB[3];
+    bool packed = a.isPacked() && b.isPacked();
+    for (int y = 0; y < a.height; y++) {
+        const GLubyte *rowA = a.row(y), *rowB = b.row(y);
+        for (int x = 0; x < a.width; x++) {
+            if (packed) {
+                *errors++ = pixelDifference<metric>(rowA + x * 3, rowB + x * 3);
+                continue;
+            }
+            a.readPixel(x, y, EdgeClamp, pixelA);
+            b.readPixel(x, y, EdgeClamp, pixelB);
+            *errors++ = pixelDifference<metric>(pixelA, pixelB);
+        }
+    }
+}
+
+void borderErrors(ErrorMetric metric, const ImageView &a, const ImageView &b, int *errors) {
+    switch (metric) {
+        case Magnitude:
+            viewErrors<Magnitude>(a, b, errors);
+            break;
+        case SquaredMagnitude:
+            viewErrors<SquaredMagnitude>(a, b, errors);
+            break;
+        case LuminanceL1:
+            viewErrors<LuminanceL1>(a, b, errors);
+            break;
+    }
+}
+
+// Minimum error cut, with the tables on the stack when LENGTH and WIDTH are known at compile time (0 otherwise)
+template <int LENGTH, int WIDTH>
+static void cutSeam(const int *errors, int length, int width, GLubyte *path) {
+    if (LENGTH > 0) length = LENGTH;
+    if (WIDTH > 0) width = WIDTH;
+    // E[r,c] = e[r,c] + min(E[r+1,c-1], E[r+1,c], E[r+1,c+1]), filled in from the last row up
+    long long fixedPathErrors[LENGTH * WIDTH > 0 ? LENGTH * WIDTH : 1];
+    int fixedNextCols[LENGTH * WIDTH > 0 ? LENGTH * WIDTH : 1];
+    long long *pathErrors = LENGTH > 0 ? fixedPathErrors : new long long[length * width]; // best cumulative error of path from this pixel to the last row
+    int *nextCols = LENGTH > 0 ? fixedNextCols : new int[length * width];                 // holds the best next column to move to from this pixel
+    
+    for (int c = 0; c < width; c++)
+        pathErrors[(length - 1) * width + c] = errors[(length - 1) * width + c];
+    for (int r = length - 2; r >= 0; r--) {
+        const long long *below = pathErrors + (r + 1) * width;
+        for (int c = 0; c < width; c++) {
+            // Go left, center or right depending on best path, preferring them in that order on ties
+            int best = c > 0 ? c - 1 : c;
+            if (below[c] < below[best])
+                best = c;
+            if (c + 1 < width && below[c + 1] < below[best])
+                best = c + 1;
+            nextCols[r * width + c] = best;
+            pathErrors[r * width + c] = errors[r * width + c] + below[best];
+        }
+    }
+    
+    // Start from the best pixel in the first row and follow the path down
+    int col = 0;
+    for (int c = 1; c < width; c++) {
+        if (pathErrors[c] < pathErrors[col])
+            col = c;
+    }
+    for (int r = 0; r < length; r++) {
+        path[r] = col;
+        if (r + 1 < length)
+            col = nextCols[r * width + col];
+    }
+    
+    if (LENGTH == 0) {
+        delete[] pathErrors;
+        delete[] nextCols;
+    }
+}
+
+void minimumErrorCut(const int *errors, int length, int width, GLubyte *path) {
+    cutSeam<0, 0>(errors, length, width, path);
+}
+
+// Errors of two overlapping borders, arranged for a cut as in SeamErrorKernel
+// BLOCK and BORDER are the block and border size when known at compile time, 0 otherwise
+template <BlockMatch type, ErrorMetric metric, int BLOCK, int BORDER>
+static void seamErrors(const ImageView &a, const ImageView &b, int length, int width, int *errors) {
+    if (BLOCK > 0) length = BLOCK;
+    if (BORDER > 0) width = BORDER;
+    const int viewWidth = type == Right ? width : length, viewHeight = type == Right ? length : width;
+    // Pixels in other layouts are read back as packed RGB, so a and b need not share a layout
+    GLubyte pixelA[3], pixelB[3];
+    bool packed = a.isPacked() && b.isPacked();
+    for (int y = 0; y < viewHeight; y++) {
+        const GLubyte *rowA = a.row(y), *rowB = b.row(y);
+        for (int x = 0; x < viewWidth; x++) {
+            int error;
+            if (packed)
+                error = pixelDifference<metric>(rowA + x * 3, rowB + x * 3);
+            else {
+                a.readPixel(x, y, EdgeClamp, pixelA);
+                b.readPixel(x, y, EdgeClamp, pixelB);
+                error = pixelDifference<metric>(pixelA, pixelB);
+            }
+            if (type == Right)
+                errors[y * width + x] = error;
+            else
+                errors[x * width + width - 1 - y] = error;
+        }
+    }
+}
+
+template <ErrorMetric metric, int BLOCK, int BORDER>
+static void selectSeamSize(SeamErrorKernel errorKernels[2], CutKernel *cutKernel) {
+    errorKernels[0] = seamErrors<Right, metric, BLOCK, BORDER>;
+    errorKernels[1] = seamErrors<Top, metric, BLOCK, BORDER>;
+    *cutKernel = cutSeam<BLOCK, BORDER>;
+}
+
+template <ErrorMetric metric>
+static void selectSeamMetric(GLsizei blockSize, GLsizei borderSize, SeamErrorKernel errorKernels[2], CutKernel *cutKernel) {
+    // Same sizes as the scan kernels are specialised for
+    if (blockSize == 16 && borderSize == 4)
+        selectSeamSize<metric, 16, 4>(errorKernels, cutKernel);
+    else if (blockSize == 32 && borderSize == 6)
+        selectSeamSize<metric, 32, 6>(errorKernels, cutKernel);
+    else if (blockSize == 64 && borderSize == 12)
+        selectSeamSize<metric, 64, 12>(errorKernels, cutKernel);
+    else
+        selectSeamSize<metric, 0, 0>(errorKernels, cutKernel);
+}
+
+void selectSeamKernels(ErrorMetric metric, GLsizei blockSize, GLsizei borderSize, SeamErrorKernel errorKernels[2], CutKernel *cutKernel) {
+    switch (metric) {
+        case SquaredMagnitude:
+            selectSeamMetric<SquaredMagnitude>(blockSize, borderSize, errorKernels, cutKernel);
+            break;
+        case LuminanceL1:
+            selectSeamMetric<LuminanceL1>(blockSize, borderSize, errorKernels, cutKernel);
+            break;
+        default:
+            selectSeamMetric<Magnitude>(blockSize, borderSize, errorKernels, cutKernel);
+            break;
+    }
+}
+
+// Bytes from one pixel to the next in layout
+template <PixelLayout layout>
+static inline int layoutPixelStride() {
+    return layout == PackedRGB ? 3 : (layout == PaddedRGBX ? 4 : 1);
+}
+
+// Error between a region of the source image and a border of the same size, both stored in layout
+// W and H are the width and height of the region when known at compile time, 0 otherwise
+template <ErrorMetric metric, PixelLayout layout, int W, int H>
+static inline long long regionError(const GLubyte *source, GLint rowLength, const ImageView &border, int w, int h) {
+    if (W > 0) w = W;
+    if (H > 0) h = H;
+    const int ps = layoutPixelStride<layout>();
+    const int cs = border.channelStride;
+    long long error = 0;
+    for (int y = 0; y < h; y++) {
+        const GLubyte *sourceRow = source + y * rowLength;
+        const GLubyte *borderRow = border.row(y);
+        int rowError = 0;
+        for (int x = 0; x < w; x++)
+            rowError += pixelDifference<metric, layout>(sourceRow + x * ps, borderRow + x * ps, cs);
+        error += rowError;
+    }
+    return error;
+}
+
+// Luminance error between a block of the source image and the target image under it
+// Layouts other than packed RGB have the luminance of the source pixels already
+template <PixelLayout layout, int BLOCK>
+static inline long long transferError(const GLubyte *source, GLint rowLength, GLint channelStride, const int *targetLuminance, int blockSize) {
+    if (BLOCK > 0) blockSize = BLOCK;
+    const int ps = layoutPixelStride<layout>();
+    const int cs = layout == PlanarRGBL ? channelStride : 1;
+    long long error = 0;
+    for (int y = 0; y < blockSize; y++) {
+        const GLubyte *sourceRow = source + y * rowLength;
+        const int *targetRow = targetLuminance + y * blockSize;
+        int rowError = 0;
+        for (int x = 0; x < blockSize; x++) {
+            const GLubyte *pixel = sourceRow + x * ps;
+            int sourceLuminance = layout == PackedRGB ? luminance(pixel[0], pixel[1], pixel[2]) : pixel[3 * cs];
+            rowError += abs(targetRow[x] - sourceLuminance);
+        }
+        error += rowError;
+    }
+    return error;
+}
+
+// Compare the borders with the appropriate borders of every block in the image
+// BLOCK and BORDER are the block and border size when known at compile time, 0 otherwise
+template <BlockMatch type, bool transfer, ErrorMetric metric, PixelLayout layout, int BLOCK, int BORDER>
+static void scanBlocks(const ScanInput &in, long long *errors) {
+    const int blockSize = BLOCK > 0 ? BLOCK : in.blockSize;
+    const int borderSize = BORDER > 0 ? BORDER : in.borderSize;
+    const int step = blockSize - borderSize;
+    const int ps = layoutPixelStride<layout>();
+    
+    for (int i = 0; i < in.numBlocks; i++) {
+        GLint index = in.candidates != NULL ? in.candidates[i] : in.firstBlock + i;
+        const GLubyte *block = in.image + (index / in.numCols) * step * in.rowLength + (index % in.numCols) * step * ps;
+        long long error = 0;
+        
+        // If a target image was given, consider proper target image block in error calculation
+        if (transfer)
+            error += transferError<layout, BLOCK>(block, in.rowLength, in.channelStride, in.targetLuminance, blockSize);
+        
+        // Left border of this block against the right border of the block to the left
+        if (type == Right || type == Both)
+            error += regionError<metric, layout, BORDER, BLOCK>(block, in.rowLength, in.leftBorder, borderSize, blockSize);
+        
+        // Bottom border of this block against the top border of the block below
+        if (type == Top || type == Both)
+            error += regionError<metric, layout, BLOCK, BORDER>(block, in.rowLength, in.bottomBorder, blockSize, borderSize);
+        
+        // Right and top borders of this block against blocks it wraps around onto
+        if (!in.wrapLeftBorder.empty())
+            error += regionError<metric, layout, BORDER, BLOCK>(block + step * ps, in.rowLength, in.wrapLeftBorder, borderSize, blockSize);
+        if (!in.wrapBottomBorder.empty())
+            error += regionError<metric, layout, BLOCK, BORDER>(block + step * in.rowLength, in.rowLength, in.wrapBottomBorder, blockSize, borderSize);
+        
+        errors[i] = error;
+    }
+}
+
+template <BlockMatch type, bool transfer, ErrorMetric metric, PixelLayout layout>
+static ScanKernel selectSize(GLsizei blockSize, GLsizei borderSize) {
+    // Fully unrolled kernels for common sizes, generic kernel for everything else
+    if (blockSize == 16 && borderSize == 4)
+        return scanBlocks<type, transfer, metric, layout, 16, 4>;
+    if (blockSize == 32 && borderSize == 6)
+        return scanBlocks<type, transfer, metric, layout, 32, 6>;
+    if (blockSize == 64 && borderSize == 12)
+        return scanBlocks<type, transfer, metric, layout, 64, 12>;
+    return scanBlocks<type, transfer, metric, layout, 0, 0>;
+}
+
+template <BlockMatch type, bool transfer, ErrorMetric metric>
+static ScanKernel selectLayout(PixelLayout layout, GLsizei blockSize, GLsizei borderSize) {
+    switch (layout) {
+        case PaddedRGBX:
+            return selectSize<type, transfer, metric, PaddedRGBX>(blockSize, borderSize);
+        case PlanarRGBL:
+            return selectSize<type, transfer, metric, PlanarRGBL>(blockSize, borderSize);
+        default:
+            return selectSize<type, transfer, metric, PackedRGB>(blockSize, borderSize);
+    }
+}
+
+template <BlockMatch type, bool transfer>
+static ScanKernel selectMetric(ErrorMetric metric, PixelLayout layout, GLsizei blockSize, GLsizei borderSize) {
+    switch (metric) {
+        case SquaredMagnitude:
+            return selectLayout<type, transfer, SquaredMagnitude>(layout, blockSize, borderSize);
+        case LuminanceL1:
+            return selectLayout<type, transfer, LuminanceL1>(layout, blockSize, borderSize);
+        default:
+            return selectLayout<type, transfer, Magnitude>(layout, blockSize, borderSize);
+    }
+}
+
+template <BlockMatch type>
+static ScanKernel selectTransfer(bool transfer, ErrorMetric metric, PixelLayout layout, GLsizei blockSize, GLsizei borderSize) {
+    if (transfer)
+        return selectMetric<type, true>(metric, layout, blockSize, borderSize);
+    return selectMetric<type, false>(metric, layout, blockSize, borderSize);
+}
+
+ScanKernel selectScanKernel(BlockMatch type, bool transfer, ErrorMetric metric, PixelLayout layout, GLsizei blockSize, GLsizei borderSize) {
+    switch (type) {
+        case Right:
+            return selectTransfer<Right>(transfer, metric, layout, blockSize, borderSize);
+        case Top:
+            return selectTransfer<Top>(transfer, metric, layout, blockSize, borderSize);
+        case Both:
+            return selectTransfer<Both>(transfer, metric, layout, blockSize, borderSize);
+        default:
+            return selectTransfer<None>(transfer, metric, layout, blockSize, borderSize);
+    }
+}
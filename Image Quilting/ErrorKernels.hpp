@@ -0,0 +1,99 @@
+//
+//  ErrorKernels.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef ErrorKernels_hpp
+#define ErrorKernels_hpp
+
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include "ImageView.hpp"
+
+enum BlockMatch {
+    Right,
+    Top,
+    Both,
+    None
+};
+
+// How the difference between two overlapping pixels is measured
+enum ErrorMetric {
+    Magnitude,          // length of the RGB difference vector
+    SquaredMagnitude,   // squared length of the RGB difference vector
+    LuminanceL1         // absolute difference in luminance
+};
+
+// Error between the pixels at a and b, stored in layout with channelStride bytes between their channels
+// Every layout but packed RGB has the luminance of each pixel stored with it
+template <ErrorMetric metric, PixelLayout layout = PackedRGB>
+inline int pixelDifference(const GLubyte *a, const GLubyte *b, int channelStride = 1) {
+    const int cs = layout == PlanarRGBL ? channelStride : 1;
+    if (metric == LuminanceL1 && layout != PackedRGB)
+        return abs(a[3 * cs] - b[3 * cs]);
+    if (metric == LuminanceL1)
+        return abs(luminance(a[0], a[1], a[2]) - luminance(b[0], b[1], b[2]));
+    int rDif = a[0] - b[0];
+    int gDif = a[cs] - b[cs];
+    int bDif = a[2 * cs] - b[2 * cs];
+    int squared = rDif * rDif + gDif * gDif + bDif * bDif;
+    if (metric == SquaredMagnitude)
+        return squared;
+    return sqrt(squared);
+}
+
+// Fill errors with the difference of every pixel of a and b, which are the same size, in raster order
+void borderErrors(ErrorMetric metric, const ImageView &a, const ImageView &b, int *errors);
+
+// Find the minimum error boundary cut through an overlap, as in Efros and Freeman's paper
+// errors is length rows of width pixel errors; the cut goes through one pixel of every row,
+// moving at most one column between rows, and path[r] is its column in row r
+void minimumErrorCut(const int *errors, int length, int width, GLubyte *path);
+
+// Fills errors with the difference of every pixel of the overlapping borders a and b, arranged for a cut:
+// length (blockSize) rows of width (borderSize) pixels. Right borders are already in that shape, Top borders
+// are turned a quarter so the cut runs along them, their top row becoming the last column
+typedef void (*SeamErrorKernel)(const ImageView &a, const ImageView &b, int length, int width, int *errors);
+// minimumErrorCut for an overlap of length rows of width pixels
+typedef void (*CutKernel)(const int *errors, int length, int width, GLubyte *path);
+
+// Get the seam kernels for a metric, specialised for the block and border size if possible like the scan kernels
+// errorKernels[0] is for Right borders and errorKernels[1] for Top borders
+void selectSeamKernels(ErrorMetric metric, GLsizei blockSize, GLsizei borderSize, SeamErrorKernel errorKernels[2], CutKernel *cutKernel);
+
+// Everything a scan needs to find the error of every block in a source image
+struct ScanInput {
+    const GLubyte *image;           // source image pixels
+    GLint rowLength;                // bytes per row of the source image
+    GLint channelStride;            // bytes between the channels of a source pixel, for the planar layout
+    GLint numCols, numBlocks;       // block grid of the source image
+    GLint step;                     // blockSize - borderSize, distance between blocks
+    GLsizei blockSize, borderSize;
+    ImageView leftBorder;           // right border of the block to the left, borderSize x blockSize
+    ImageView bottomBorder;         // top border of the block below, blockSize x borderSize
+    ImageView wrapLeftBorder;       // left border of the block wrapping around to the right, or empty
+    ImageView wrapBottomBorder;     // bottom border of the block wrapping around above, or empty
+    const int *targetLuminance;     // luminance of the target image under the block, for transfer
+    const GLint *candidates;        // if not NULL, only these numBlocks blocks are scanned
+    GLint firstBlock;               // otherwise the numBlocks blocks from this one are
+};
+
+// Fills errors[i] with the error of placing source block firstBlock + i, for numBlocks blocks in the source image,
+// or of placing block candidates[i] if there are candidates
+typedef void (*ScanKernel)(const ScanInput &input, long long *errors);
+
+// Get the scan kernel for this kind of matching and the source's pixel layout,
+// specialised for the block and border size if possible
+ScanKernel selectScanKernel(BlockMatch type, bool transfer, ErrorMetric metric, PixelLayout layout, GLsizei blockSize, GLsizei borderSize);
+
+#endif /* ErrorKernels_hpp */
@@ -7,93 +7,181 @@
 //
 
 #include "Image.hpp"
+#include "QOICodec.hpp"
+#include "ImageWriter.hpp"
 #include <iostream>
 #include <string>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+// Rows of layouts other than packed RGB start on multiples of this many bytes, for aligned vector loads
+static const int rowAlignment = 32;
+
+// Whether an image of this size fits in memory as RGB, with byte offsets that fit in an int
+static bool validSize(GLsizei w, GLsizei h) {
+    return w > 0 && h > 0 && (size_t)w * h <= 0x7fffffff / 3;
+}
 
 // Create standard image object from filepath
-Image::Image(const char *filename) {
+// Images that can't be read are left empty, with getReadError saying why
+Image::Image(const char *filename, PixelLayout l) {
+    imageData = NULL;
+    width = height = 0;
     std::string fname = (std::string)filename;
-    std::string extension = fname.substr(fname.find_last_of("."));
+    size_t dot = fname.find_last_of(".");
+    std::string extension = dot == std::string::npos ? "" : fname.substr(dot);
+    bool ok;
     if (extension.compare(".ppm") == 0)
-        readPPM(filename, &imageData);
+        ok = readPPM(filename, &imageData);
     else if (extension.compare(".bmp") == 0)
-        readBMP(filename);
+        ok = readBMP(filename);
+    else if (extension.compare(".qoi") == 0)
+        ok = readQOI(filename);
     else {
-        std::cout << fname << " is of an unsupported file type.\n";
-        exit(-1);
+        readError = fname + " is of an unsupported file type.";
+        ok = false;
+    }
+    if (!ok) {
+        std::cout << readError << "\n";
+        delete [] imageData;
+        imageData = NULL;
+        width = height = 0;
     }
+    allocation = imageData;
+    layout = PackedRGB;
+    rowStride = width * 3;
+    pixelStride = 3;
+    channelStride = 1;
+    if (ok && l != PackedRGB)
+        convertLayout(l);
+}
+
+// Create a blank (black) image of the given size to be drawn into
+Image::Image(GLsizei w, GLsizei h) {
+    width = w;
+    height = h;
+    imageData = allocation = new GLubyte[(size_t)width * height * 3]();
+    layout = PackedRGB;
+    rowStride = width * 3;
+    pixelStride = 3;
+    channelStride = 1;
 }
 
 Image::~Image() {
-    delete [] imageData;
+    delete [] allocation;
+}
+
+// Convert the packed RGB pixels to newLayout, adding the luminance of every pixel
+void Image::convertLayout(PixelLayout newLayout) {
+    ImageView packed = view();
+    GLint newPixelStride = newLayout == PaddedRGBX ? 4 : 1;
+    GLint newRowStride = (width * newPixelStride + rowAlignment - 1) / rowAlignment * rowAlignment;
+    // Planes follow each other, a whole image apart
+    GLint newChannelStride = newLayout == PlanarRGBL ? newRowStride * height : 1;
+    int planes = newLayout == PlanarRGBL ? 4 : 1;
+    
+    GLubyte *newAllocation = new GLubyte[(size_t)newRowStride * height * planes + rowAlignment]();
+    GLubyte *newData = newAllocation + (rowAlignment - (uintptr_t)newAllocation % rowAlignment) % rowAlignment;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const GLubyte *source = packed.pixel(x, y);
+            GLubyte *target = newData + y * newRowStride + x * newPixelStride;
+            target[0] = source[0];
+            target[newChannelStride] = source[1];
+            target[2 * newChannelStride] = source[2];
+            target[3 * newChannelStride] = luminance(source[0], source[1], source[2]);
+        }
+    }
+    
+    delete [] allocation;
+    allocation = newAllocation;
+    imageData = newData;
+    layout = newLayout;
+    rowStride = newRowStride;
+    pixelStride = newPixelStride;
+    channelStride = newChannelStride;
 }
 
 // Read a ppm file and put the contents in pic and set width and height
-void Image::readPPM(const char *filename, GLubyte **pic) {
+// Returns false, with readError set, if it isn't a whole binary ppm file
+bool Image::readPPM(const char *filename, GLubyte **pic) {
     FILE *file;
     char line[80];
-    int size, rowSize;
+    size_t size, rowSize;
     file = fopen(filename, "rb");
     if (file == NULL) {
-        std::cout << filename << " cannot be read.\n";
-        exit(-1);
+        readError = (std::string)filename + " cannot be read.";
+        return false;
     }
     
-    // line with file type
-    fgets(line, 80, file);
-    
-    // line with width and height
-    fgets(line, 80, file);
-    sscanf(line, "%d %d", &width, &height);
+    // line with file type, line with width and height, line with max value
+    if (fgets(line, 80, file) == NULL || line[0] != 'P' || line[1] != '6' ||
+        fgets(line, 80, file) == NULL || sscanf(line, "%d %d", &width, &height) != 2 || !validSize(width, height) ||
+        fgets(line, 80, file) == NULL) {
+        readError = (std::string)filename + " is not a valid ppm file.";
+        fclose(file);
+        return false;
+    }
     std::cout << "Reading " << filename << "...\nwidth:" << width << " height:" << height << "\n";
-    size = width * height * 3; // 3 bytes per pixel
+    size = (size_t)width * height * 3; // 3 bytes per pixel
     rowSize = width * 3;
     *pic = new GLubyte[size];
     
-    fgets(line, 80, file);
-    
     // Read image from bottom up
     GLubyte *ptr;
     ptr = *pic + (height-1) * rowSize;
-    for (int i = height; i > 0; i--) {
-        fread(ptr, 1, rowSize, file);
+    bool ok = true;
+    for (int i = height; i > 0 && ok; i--) {
+        ok = fread(ptr, 1, rowSize, file) == rowSize;
         ptr -= rowSize;
     }
     fclose(file);
+    if (!ok)
+        readError = (std::string)filename + " is truncated.";
+    return ok;
 }
 
 // Read a bmp file and put the contents in pic and set width and height
-void Image::readBMP(const char *filename) {
+// Returns false, with readError set, if it isn't a whole bmp file
+bool Image::readBMP(const char *filename) {
     FILE* f = fopen(filename, "rb");
     if (f == NULL) {
-        std::cout << filename << " cannot be read.\n";
-        exit(-1);
+        readError = (std::string)filename + " cannot be read.";
+        return false;
     }
     
     // read the 54-byte header
     GLubyte info[54];
-    fread(info, sizeof(GLubyte), 54, f);
+    if (fread(info, sizeof(GLubyte), 54, f) != 54 || info[0] != 'B' || info[1] != 'M') {
+        readError = (std::string)filename + " is not a valid bmp file.";
+        fclose(f);
+        return false;
+    }
     
     // extract image height and width from header
     width = *(int*)&info[18];
     height = *(int*)&info[22];
+    if (!validSize(width, height)) {
+        readError = (std::string)filename + " is not a valid bmp file.";
+        fclose(f);
+        return false;
+    }
     std::cout << "Reading " << filename << "...\nwidth:" << width << " height:" << height << "\n";
     
-    int size = 3 * width * height;
+    size_t size = (size_t)3 * width * height;
     imageData = new GLubyte[size]; // allocate 3 bytes per pixel
-
-    // read in the bitmap image data
-    fread(imageData, size, 1, f);
     
+    // read in the bitmap image data
     // make sure bitmap image data was read
-    if (imageData == NULL) {
-        std::cout << filename << " cannot be read.\n";
+    if (fread(imageData, 1, size, f) != size) {
+        readError = (std::string)filename + " is truncated.";
         fclose(f);
-        exit(-1);
+        return false;
     }
-
+    
     // swap the r and b values to get RGB (bitmap is BGR)
-    for (int imageIdx = 0; imageIdx < size; imageIdx += 3) {
+    for (size_t imageIdx = 0; imageIdx < size; imageIdx += 3) {
         GLubyte tempRGB = imageData[imageIdx];
         imageData[imageIdx] = imageData[imageIdx + 2];
         imageData[imageIdx + 2] = tempRGB;
@@ -101,38 +189,121 @@ void Image::readBMP(const char *filename) {
     
     //close file and return bitmap iamge data
     fclose(f);
+    return true;
+}
+
+// Read a qoi file, see QOICodec, and set width and height
+// Returns false, with readError set, if it isn't a whole qoi file
+bool Image::readQOI(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        readError = (std::string)filename + " cannot be read.";
+        return false;
+    }
+    std::vector<GLubyte> data;
+    GLubyte buffer[65536];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + read);
+    fclose(file);
+    
+    imageData = decodeQOI(data, &width, &height);
+    if (imageData == NULL) {
+        readError = (std::string)filename + " is not a valid qoi file.";
+        return false;
+    }
+    std::cout << "Reading " << filename << "...\nwidth:" << width << " height:" << height << "\n";
+    return true;
+}
+
+// Read only the width and height of the image at filename, without loading it
+// Returns false if the file cannot be read or is of an unsupported type
+bool Image::readDimensions(const char *filename, GLsizei *w, GLsizei *h) {
+    std::string fname = (std::string)filename;
+    size_t dot = fname.find_last_of(".");
+    std::string extension = dot == std::string::npos ? "" : fname.substr(dot);
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return false;
+    
+    bool ok = false;
+    if (extension.compare(".ppm") == 0) {
+        // line with file type, then line with width and height
+        char line[80];
+        ok = fgets(line, 80, file) != NULL && fgets(line, 80, file) != NULL && sscanf(line, "%d %d", w, h) == 2;
+    }
+    else if (extension.compare(".bmp") == 0) {
+        GLubyte info[54];
+        ok = fread(info, sizeof(GLubyte), 54, file) == 54;
+        if (ok) {
+            *w = *(int*)&info[18];
+            *h = *(int*)&info[22];
+        }
+    }
+    else if (extension.compare(".qoi") == 0) {
+        GLubyte header[14];
+        ok = readQOIHeader(header, fread(header, 1, sizeof(header), file), w, h);
+    }
+    fclose(file);
+    return ok && *w > 0 && *h > 0;
+}
+
+// Write this image to filename, in the format given by its extension, see ImageWriter
+// Returns false if the file could not be written
+bool Image::writeFile(const char *filename) {
+    ImageWriter *writer = createImageWriter(view(), filename);
+    if (writer == NULL)
+        return false;
+    bool ok = writer->write();
+    delete writer;
+    return ok;
 }
 
 // Draw this image on the screen
 void Image::drawFullImage() {
     glDrawBuffer(GL_FRONT);
-    glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, imageData);
+    // Rows are tightly packed, not aligned to 4 bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glRasterPos2i(0, 0);
+    if (layout == PackedRGB) {
+        glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, imageData);
+        return;
+    }
+    GLubyte *packed = new GLubyte[(size_t)width * height * 3];
+    readPixels(0, 0, width, height, packed);
+    glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, packed);
+    delete [] packed;
 }
 
 // Copy the data of this image at the given coordinates and size into targetArray
+// Pixels outside of the image are black
 void Image::readPixels(int startX, int startY, int readWidth, int readHeight, GLubyte *targetArray) {
-    /*
-    // Cancel read if coordinates go out of bounds
-    if (startY + readHeight > height || startX + readWidth > width) {
-        std::cout << "Invalid coordinates for read pixels.\n";
-        return;
-    }
-    */
+    ImageView pixels = view();
     for (int y = 0; y < readHeight; y++) {
-        for (int x = 0; x < readWidth; x++) {
-            // TODO: excessive calculation...
-            int targetIndex = (y * readWidth + x) * 3;
-            int sourceIndex = ((startY + y) * width + startX + x) * 3;
-            // TODO: this can probably be done quicker, without a check every iteration
-            if (x + startX > width || y + startY >= height) {
-                targetArray[targetIndex] = 0;
-                targetArray[targetIndex + 1] = 0;
-                targetArray[targetIndex + 2] = 0;
-            } else {
-                targetArray[targetIndex] = imageData[sourceIndex];
-                targetArray[targetIndex + 1] = imageData[sourceIndex + 1];
-                targetArray[targetIndex + 2] = imageData[sourceIndex + 2];
-            }
+        GLubyte *targetRow = targetArray + y * readWidth * 3;
+        // Packed rows that are entirely inside the image are copied at once
+        if (layout == PackedRGB && startX >= 0 && startX + readWidth <= width && startY + y >= 0 && startY + y < height) {
+            memcpy(targetRow, pixels.pixel(startX, startY + y), readWidth * 3);
+            continue;
+        }
+        for (int x = 0; x < readWidth; x++)
+            pixels.readPixel(startX + x, startY + y, EdgeZero, targetRow + x * 3);
+    }
+}
+
+// Copy sourceArray into this image at the given coordinates and size, skipping pixels that fall outside of the image
+void Image::writePixels(int startX, int startY, int writeWidth, int writeHeight, const GLubyte *sourceArray) {
+    for (int y = 0; y < writeHeight; y++) {
+        if (y + startY < 0 || y + startY >= height)
+            continue;
+        for (int x = 0; x < writeWidth; x++) {
+            if (x + startX < 0 || x + startX >= width)
+                continue;
+            int sourceIndex = (y * writeWidth + x) * 3;
+            int targetIndex = ((startY + y) * width + startX + x) * 3;
+            imageData[targetIndex] = sourceArray[sourceIndex];
+            imageData[targetIndex + 1] = sourceArray[sourceIndex + 1];
+            imageData[targetIndex + 2] = sourceArray[sourceIndex + 2];
         }
     }
 }
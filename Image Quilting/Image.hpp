@@ -10,24 +10,49 @@
 #define Image_hpp
 
 #include <stdio.h>
+#include <string>
 #ifdef __APPLE__
 #include <GLUT/glut.h>
 #else
 #include <GL/glut.h>
 #endif
 
+#include "ImageView.hpp"
+
 class Image {
 protected:
     GLubyte *imageData;
-    void readPPM(const char *filename, GLubyte **pic);
-    void readBMP(const char *filename);
+    // What imageData was allocated as, which is only different when it was aligned
+    GLubyte *allocation;
+    PixelLayout layout;
+    GLint rowStride, pixelStride, channelStride;
+    // Why the image couldn't be read, empty if it was
+    std::string readError;
+    bool readPPM(const char *filename, GLubyte **pic);
+    bool readBMP(const char *filename);
+    bool readQOI(const char *filename);
 public:
     Image();
-    Image(const char *filename);
+    // Pixels are converted from packed RGB to layout once here, see PixelLayout
+    // Images that can't be read are left empty and getReadError says why, it is empty for images that were read
+    Image(const char *filename, PixelLayout l = PackedRGB);
+    Image(GLsizei w, GLsizei h);
     ~Image();
+    const std::string &getReadError() const { return readError; }
     GLsizei width, height;
+    // Pixels in the image's layout, which is packed RGB unless it was read in another one
+    GLubyte *getData() { return imageData; }
+    PixelLayout getLayout() const { return layout; }
+    // Convert a packed RGB image to newLayout, which images read from a file do when they are given one
+    void convertLayout(PixelLayout newLayout);
+    // View of the whole image, for reading its pixels in place
+    ImageView view() const { return ImageView(imageData, width, height, rowStride, pixelStride, channelStride); }
+    // Read and write packed RGB; only packed images can be written to
     void readPixels(int startX, int startY, int width, int height, GLubyte *targetArray);
+    void writePixels(int startX, int startY, int width, int height, const GLubyte *sourceArray);
     void drawFullImage();
+    static bool readDimensions(const char *filename, GLsizei *w, GLsizei *h);
+    bool writeFile(const char *filename);
 };
 
 #endif /* Image_hpp */
@@ -0,0 +1,86 @@
+//
+//  ImageView.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef ImageView_hpp
+#define ImageView_hpp
+
+#include <stdio.h>
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+// What reading a pixel outside of a view gives
+enum EdgePolicy {
+    EdgeClamp,  // the nearest pixel inside the view
+    EdgeZero,   // black
+    EdgeWrap    // the pixel on the opposite side, as if the view repeated
+};
+
+// How an image holds its pixels in memory
+// Images are always read and written as packed RGB; the other layouts are converted to once, when an image is read,
+// so the error kernels can read whole aligned rows of pixels and a precomputed luminance
+enum PixelLayout {
+    PackedRGB,      // 3 bytes per pixel, rows back to back
+    PaddedRGBX,     // 4 bytes per pixel, the fourth being its luminance, rows aligned and padded to 32 bytes
+    PlanarRGBL      // a plane each of red, green, blue and luminance, rows aligned and padded to 32 bytes
+};
+
+// Get the luminance value from RGB set
+// R G and B are weighed differently because of human eye color sensitivity
+inline int luminance(int r, int g, int b) {
+    return 0.299 * r + 0.587 * g + 0.114 * b;
+}
+
+// A window onto pixels stored somewhere else, bottom up like Image, for reading them in place
+// stride is the number of bytes from one row to the next, so a view can be a rectangle inside a larger image
+// pixelStride and channelStride are the bytes from one pixel to the next and from one channel of a pixel to the next,
+// 3 and 1 for packed RGB; in any other layout the pixel's luminance follows its blue channel
+struct ImageView {
+    const GLubyte *data;    // bottom left pixel
+    GLsizei width, height;
+    GLint stride;
+    GLint pixelStride, channelStride;
+    
+    ImageView() : data(NULL), width(0), height(0), stride(0), pixelStride(3), channelStride(1) {}
+    ImageView(const GLubyte *d, GLsizei w, GLsizei h, GLint s, GLint ps = 3, GLint cs = 1) : data(d), width(w), height(h), stride(s), pixelStride(ps), channelStride(cs) {}
+    
+    bool empty() const { return data == NULL; }
+    bool isPacked() const { return pixelStride == 3; }
+    const GLubyte *row(int y) const { return data + y * stride; }
+    const GLubyte *pixel(int x, int y) const { return data + y * stride + x * pixelStride; }
+    
+    // The view of [x, x + w) x [y, y + h) of this view, which must lie inside it
+    ImageView subView(int x, int y, int w, int h) const { return ImageView(pixel(x, y), w, h, stride, pixelStride, channelStride); }
+    
+    // Copy the RGB of the pixel at x, y into rgb, where coordinates outside of the view are resolved by policy
+    void readPixel(int x, int y, EdgePolicy policy, GLubyte *rgb) const {
+        if (x < 0 || x >= width || y < 0 || y >= height) {
+            switch (policy) {
+                case EdgeClamp:
+                    x = x < 0 ? 0 : (x >= width ? width - 1 : x);
+                    y = y < 0 ? 0 : (y >= height ? height - 1 : y);
+                    break;
+                case EdgeWrap:
+                    x = ((x % width) + width) % width;
+                    y = ((y % height) + height) % height;
+                    break;
+                default:
+                    rgb[0] = rgb[1] = rgb[2] = 0;
+                    return;
+            }
+        }
+        const GLubyte *p = pixel(x, y);
+        rgb[0] = p[0];
+        rgb[1] = p[channelStride];
+        rgb[2] = p[2 * channelStride];
+    }
+};
+
+#endif /* ImageView_hpp */
@@ -0,0 +1,75 @@
+//
+//  ImageWriter.cpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#include "ImageWriter.hpp"
+#include "QOICodec.hpp"
+#include <iostream>
+#include <cstring>
+
+ImageWriter *createImageWriter(const ImageView &view, const char *filename) {
+    std::string fname = (std::string)filename;
+    size_t dot = fname.find_last_of(".");
+    std::string extension = dot == std::string::npos ? "" : fname.substr(dot);
+    if (extension.compare(".ppm") == 0)
+        return new PPMWriter(view, filename);
+    if (extension.compare(".qoi") == 0)
+        return new QOIBandEncoder(view, filename);
+    std::cout << fname << " is of an unsupported file type.\n";
+    return NULL;
+}
+
+// The file is created right away, so a path that can't be written to is found before the image is made
+PPMWriter::PPMWriter(const ImageView &view, const char *f) : ImageWriter(view, f) {
+    rowsWritten = 0;
+    file = fopen(f, "wb");
+    ok = file != NULL && fprintf(file, "P6\n%d %d\n255\n", image.width, image.height) > 0;
+    dataOffset = file != NULL ? ftell(file) : 0;
+    if (!ok)
+        std::cout << filename << " cannot be written.\n";
+}
+
+PPMWriter::~PPMWriter() {
+    if (file != NULL)
+        fclose(file);
+}
+
+void PPMWriter::rowsFinished(int y) {
+    if (y > image.height)
+        y = image.height;
+    if (!ok || y <= rowsWritten)
+        return;
+    
+    // The new rows are one stretch of the file, from row y - 1 at its top down to rowsWritten
+    // Other layouts are packed back into RGB
+    size_t rowSize = (size_t)image.width * 3;
+    buffer.resize(rowSize * (y - rowsWritten));
+    GLubyte *out = buffer.data();
+    for (int r = y - 1; r >= rowsWritten; r--, out += rowSize) {
+        if (image.isPacked())
+            memcpy(out, image.row(r), rowSize);
+        else {
+            for (int x = 0; x < image.width; x++)
+                image.readPixel(x, r, EdgeZero, out + x * 3);
+        }
+    }
+    ok = fseek(file, dataOffset + (long)(image.height - y) * rowSize, SEEK_SET) == 0 &&
+         fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    if (!ok)
+        std::cout << filename << " cannot be written.\n";
+    rowsWritten = y;
+}
+
+bool PPMWriter::write() {
+    rowsFinished(image.height);
+    if (file == NULL)
+        return false;
+    bool closed = fclose(file) == 0;
+    file = NULL;
+    if (ok && !closed)
+        std::cout << filename << " cannot be written.\n";
+    return ok && closed;
+}
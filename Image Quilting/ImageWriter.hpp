@@ -0,0 +1,56 @@
+//
+//  ImageWriter.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef ImageWriter_hpp
+#define ImageWriter_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include "ImageView.hpp"
+
+// Writes an image to a file while it is still being made, as Texture reports the rows that are finished
+// Images are built from the bottom up; rows that never get reported are written by write
+class ImageWriter {
+protected:
+    ImageView image;
+    std::string filename;
+public:
+    ImageWriter(const ImageView &view, const char *f) : image(view), filename(f) {}
+    virtual ~ImageWriter() {}
+    // Rows [0, y) of the image won't change any more
+    virtual void rowsFinished(int y) = 0;
+    // Write the rows that are left and finish the file; returns false if it could not be written
+    virtual bool write() = 0;
+};
+
+// Writer for filename in the format given by its extension, ppm or qoi, or NULL if it is neither
+ImageWriter *createImageWriter(const ImageView &view, const char *filename);
+
+// Writes finished rows straight to their place in a binary ppm file, which goes from the top row down
+class PPMWriter : public ImageWriter {
+private:
+    FILE *file;
+    long dataOffset;
+    int rowsWritten;
+    bool ok;
+    std::vector<GLubyte> buffer;
+public:
+    PPMWriter(const ImageView &view, const char *f);
+    ~PPMWriter();
+    void rowsFinished(int y);
+    bool write();
+};
+
+#endif /* ImageWriter_hpp */
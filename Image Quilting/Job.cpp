@@ -0,0 +1,264 @@
+//
+//  Job.cpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#include "Job.hpp"
+#include "Image.hpp"
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+
+Job::Job() {
+    blockSize = borderSize = 0;
+    randomness = 1;
+    width = height = 0;
+    tileable = false;
+    metric = Magnitude;
+    search = ExhaustiveSearch;
+    autoSearch = false;
+    deadline = 0;
+    sourceMemory = 0;
+    pixelLayout = PackedRGB;
+    tileSize = 0;
+    processes = 1;
+}
+
+std::string Job::sourceKey() const {
+    std::ostringstream key;
+    key << sourcePath << "|" << blockSize << "|" << borderSize << "|" << randomness << "|" << metric << "|" << sourceMemory << "|" << pixelLayout;
+    return key.str();
+}
+
+bool parseJob(const std::vector<std::string> &args, Job &job, std::string &error) {
+    // Pull the options out of the arguments, leaving the positional arguments
+    std::vector<std::string> positional;
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string &arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == "--tileable")
+            job.tileable = true;
+        else if (arg == "--save-layout" && hasValue)
+            job.saveLayoutPath = args[++i];
+        else if (arg == "--load-layout" && hasValue)
+            job.loadLayoutPath = args[++i];
+        else if (arg == "--output" && hasValue)
+            job.outputPath = args[++i];
+        else if (arg == "--source-memory" && hasValue)
+            job.sourceMemory = atoi(args[++i].c_str());
+        else if (arg == "--deadline" && hasValue)
+            job.deadline = atoi(args[++i].c_str());
+        else if (arg == "--tiles" && hasValue)
+            job.tileSize = atoi(args[++i].c_str());
+        else if (arg == "--processes" && hasValue)
+            job.processes = atoi(args[++i].c_str());
+        else if (arg == "--tuning" && hasValue)
+            job.tuningPath = args[++i];
+        else if (arg == "--tile-dir" && hasValue)
+            job.tileDir = args[++i];
+        else if (arg == "--search" && hasValue) {
+            const std::string &search = args[++i];
+            job.autoSearch = false;
+            if (search == "exhaustive")
+                job.search = ExhaustiveSearch;
+            else if (search == "patchmatch")
+                job.search = PatchMatchSearch;
+            else if (search == "auto")
+                job.autoSearch = true;
+            else {
+                error = "Unknown search " + search + ".";
+                return false;
+            }
+        }
+        else if (arg == "--pixels" && hasValue) {
+            const std::string &layout = args[++i];
+            if (layout == "packed")
+                job.pixelLayout = PackedRGB;
+            else if (layout == "rgbx")
+                job.pixelLayout = PaddedRGBX;
+            else if (layout == "planar")
+                job.pixelLayout = PlanarRGBL;
+            else {
+                error = "Unknown pixel layout " + layout + ".";
+                return false;
+            }
+        }
+        else if (arg == "--metric" && hasValue) {
+            const std::string &metric = args[++i];
+            if (metric == "magnitude")
+                job.metric = Magnitude;
+            else if (metric == "squared")
+                job.metric = SquaredMagnitude;
+            else if (metric == "luminance")
+                job.metric = LuminanceL1;
+            else {
+                error = "Unknown error metric " + metric + ".";
+                return false;
+            }
+        }
+        else if (arg.compare(0, 2, "--") == 0) {
+            error = "Unknown option " + arg + ".";
+            return false;
+        }
+        else
+            positional.push_back(arg);
+    }
+    
+    // args for synthesis: sourceImage blockSize borderSize randomness width height
+    // args for transfer: sourceImage blockSize borderSize randomness targetImage
+    if (positional.size() != 6 && positional.size() != 5) {
+        error = "Invalid number of arguments.";
+        return false;
+    }
+    job.sourcePath = positional[0];
+    job.blockSize = atoi(positional[1].c_str());
+    job.borderSize = atoi(positional[2].c_str());
+    job.randomness = atoi(positional[3].c_str());
+    if (positional.size() == 6) {
+        job.width = atoi(positional[4].c_str());
+        job.height = atoi(positional[5].c_str());
+    }
+    else {
+        job.targetPath = positional[4];
+        if (job.tileable) {
+            error = "--tileable is only supported for texture synthesis.";
+            return false;
+        }
+        if (job.isTiled()) {
+            error = "--tiles is only supported for texture synthesis.";
+            return false;
+        }
+    }
+    if (job.isTiled() && (job.tileable || !job.saveLayoutPath.empty() || !job.loadLayoutPath.empty())) {
+        error = "--tiles cannot be combined with --tileable or layouts.";
+        return false;
+    }
+    if (job.isTiled() && job.deadline != 0) {
+        error = "--tiles cannot be combined with --deadline.";
+        return false;
+    }
+    if (job.isTiled() && job.outputPath.empty()) {
+        error = "--tiles needs an --output path.";
+        return false;
+    }
+    // Pages of a paged source are only read as packed RGB
+    if (job.sourceMemory != 0 && job.pixelLayout != PackedRGB) {
+        error = "--pixels cannot be combined with --source-memory.";
+        return false;
+    }
+    return true;
+}
+
+// Largest image a job can read or make, so its pixels fit in memory and their byte offsets in an int
+static const GLsizei maxImageSide = 1 << 16;
+static const size_t maxImagePixels = 1 << 28;
+
+static bool imageTooLarge(GLsizei width, GLsizei height) {
+    return width > maxImageSide || height > maxImageSide || (size_t)width * height > maxImagePixels;
+}
+
+size_t sourceMemoryBytes(const Job &job) {
+    return (size_t)job.sourceMemory * 1024 * 1024;
+}
+
+bool checkJob(const Job &job, std::string &error) {
+    if (job.borderSize < 1 || job.borderSize > 256 || job.borderSize >= job.blockSize) {
+        error = "Border size must be between 1 and 256 and less than block size.";
+        return false;
+    }
+    if (job.sourceMemory < 0) {
+        error = "Source memory must be at least 0.";
+        return false;
+    }
+    if (job.deadline < 0) {
+        error = "Deadline must be at least 0.";
+        return false;
+    }
+    if (job.randomness < 1) {
+        error = "Randomness must be at least 1.";
+        return false;
+    }
+    if (!job.isTransfer() && (job.width < 1 || job.height < 1)) {
+        error = "Width and height must be at least 1.";
+        return false;
+    }
+    if (!job.isTransfer() && imageTooLarge(job.width, job.height)) {
+        error = "Width and height must be at most 65536, and at most 268435456 pixels in all.";
+        return false;
+    }
+    
+    if (job.isTiled() && (job.tileSize < job.blockSize || job.processes < 1)) {
+        error = "Tile size must be at least block size and there must be at least 1 process.";
+        return false;
+    }
+    
+    GLsizei sourceWidth, sourceHeight;
+    if (!Image::readDimensions(job.sourcePath.c_str(), &sourceWidth, &sourceHeight)) {
+        error = job.sourcePath + " cannot be read.";
+        return false;
+    }
+    // Random blocks are picked from all but the last column and row, so there have to be at least two of each
+    if (sourceWidth < 2 * job.blockSize - job.borderSize || sourceHeight < 2 * job.blockSize - job.borderSize) {
+        error = job.sourcePath + " is smaller than two overlapping blocks on each side.";
+        return false;
+    }
+    if (imageTooLarge(sourceWidth, sourceHeight)) {
+        error = job.sourcePath + " is too large.";
+        return false;
+    }
+    
+    std::string outputExtension = job.outputPath.size() >= 4 ? job.outputPath.substr(job.outputPath.size() - 4) : "";
+    if (!job.outputPath.empty() && outputExtension != ".ppm" && outputExtension != ".qoi") {
+        error = job.outputPath + " is of an unsupported file type.";
+        return false;
+    }
+    
+    GLsizei targetWidth, targetHeight;
+    if (job.isTransfer() && !Image::readDimensions(job.targetPath.c_str(), &targetWidth, &targetHeight)) {
+        error = job.targetPath + " cannot be read.";
+        return false;
+    }
+    if (job.isTransfer() && imageTooLarge(targetWidth, targetHeight)) {
+        error = job.targetPath + " is too large.";
+        return false;
+    }
+    return true;
+}
+
+const char *metricName(ErrorMetric metric) {
+    switch (metric) {
+        case SquaredMagnitude: return "squared";
+        case LuminanceL1: return "luminance";
+        default: return "magnitude";
+    }
+}
+
+const char *pixelLayoutName(PixelLayout layout) {
+    switch (layout) {
+        case PaddedRGBX: return "rgbx";
+        case PlanarRGBL: return "planar";
+        default: return "packed";
+    }
+}
+
+void printJobUsage() {
+    std::cout << "Texture synthesis: source_image_path block_size border_size randomness width height [options]\n";
+    std::cout << "Texture transfer: source_image_path block_size border_size randomness target_image_path [options]\n";
+    std::cout << "Options:\n";
+    std::cout << "  --tileable            make the synthesized texture repeat seamlessly (size is rounded to whole blocks)\n";
+    std::cout << "  --save-layout <path>  save which blocks were placed where, to recreate the texture later\n";
+    std::cout << "  --load-layout <path>  recreate a texture from a saved layout instead of generating it\n";
+    std::cout << "  --metric <metric>     how overlapping pixels are compared: magnitude (default), squared or luminance\n";
+    std::cout << "  --search <search>     how blocks are found: exhaustive (default) compares every block, patchmatch is much faster for large sources,\n";
+    std::cout << "                        auto chooses between them, batched errors and threads from this machine's measured speed\n";
+    std::cout << "  --tuning <path>       where --search auto keeps its measurements (default ~/.image_quilting_tuning)\n";
+    std::cout << "  --deadline <ms>       generate the texture within this many milliseconds, searching less as time runs out\n";
+    std::cout << "  --source-memory <mb>  read the source image a page at a time, keeping at most this many megabytes of it in memory\n";
+    std::cout << "  --pixels <layout>     how the source image is held in memory: packed (default), rgbx or planar, which scan faster\n";
+    std::cout << "  --output <path>       write the texture to a ppm or qoi file instead of showing it\n";
+    std::cout << "  --tiles <size>        synthesize in tiles of this size in separate processes and stitch them (needs --output)\n";
+    std::cout << "  --processes <n>       number of local processes for --tiles (default 1)\n";
+    std::cout << "  --tile-dir <path>     directory tiles are exchanged through, shared with any --tile-worker processes\n";
+}
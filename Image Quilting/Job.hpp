@@ -0,0 +1,72 @@
+//
+//  Job.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef Job_hpp
+#define Job_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "ErrorKernels.hpp"
+#include "SourceImage.hpp"
+
+// A texture synthesis or transfer job, as given on the command line or to the server
+struct Job {
+    std::string sourcePath;
+    GLsizei blockSize, borderSize;
+    GLint randomness;
+    // For synthesis, the size of the texture
+    int width, height;
+    // For transfer, the image to redraw; empty for synthesis
+    std::string targetPath;
+    bool tileable;
+    ErrorMetric metric;
+    SearchStrategy search;
+    // Let the auto-tuner choose the search, and where it keeps what it measured (empty for the default)
+    bool autoSearch;
+    std::string tuningPath;
+    // Milliseconds to generate the texture in, searching less as time runs out; 0 for no deadline
+    int deadline;
+    // Megabytes of the source image to keep in memory, reading it a page at a time; 0 to load all of it
+    int sourceMemory;
+    // How a source image loaded all at once holds its pixels
+    PixelLayout pixelLayout;
+    // Optional files to write the texture and its layout to, or read the layout from
+    std::string outputPath, saveLayoutPath, loadLayoutPath;
+    // For tiled synthesis, the size of each tile (0 to synthesize in one piece),
+    // how many local worker processes to run and the directory tiles are exchanged through
+    int tileSize, processes;
+    std::string tileDir;
+    
+    Job();
+    bool isTiled() const { return tileSize > 0; }
+    bool isTransfer() const { return !targetPath.empty(); }
+    // identifies the prepared source image this job needs
+    std::string sourceKey() const;
+};
+
+// Parse args (without the executable name) into job
+// Returns false and sets error if the arguments are invalid
+bool parseJob(const std::vector<std::string> &args, Job &job, std::string &error);
+
+// Check that the job's sizes make sense and its images can be read, so running it will not exit
+// Returns false and sets error otherwise
+bool checkJob(const Job &job, std::string &error);
+
+// The memory cap for the job's source image in bytes, 0 for none
+size_t sourceMemoryBytes(const Job &job);
+
+// Name of metric as given to --metric
+const char *metricName(ErrorMetric metric);
+
+// Name of layout as given to --pixels
+const char *pixelLayoutName(PixelLayout layout);
+
+// Print the arguments parseJob accepts
+void printJobUsage();
+
+#endif /* Job_hpp */
@@ -0,0 +1,254 @@
+//
+//  QOICodec.cpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#include "QOICodec.hpp"
+#include <iostream>
+#include <atomic>
+#include <cstdint>
+
+// Chunk tags, see https://qoiformat.org/qoi-specification.pdf
+static const GLubyte opIndex = 0x00;
+static const GLubyte opDiff = 0x40;
+static const GLubyte opLuma = 0x80;
+static const GLubyte opRun = 0xc0;
+static const GLubyte opRGB = 0xfe;
+static const GLubyte opRGBA = 0xff;
+static const GLubyte tagMask = 0xc0;
+static const int headerSize = 14;
+static const int maxRun = 62;
+// The stream ends with seven zero bytes and a one
+static const GLubyte endMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+// Pixels are compared as RGBA packed into an int, alpha always being opaque
+// The empty color index is all zeros, transparent black, so it never matches a pixel
+static inline uint32_t packPixel(GLubyte r, GLubyte g, GLubyte b, GLubyte a) {
+    return r | g << 8 | b << 16 | (uint32_t)a << 24;
+}
+
+static inline int colorHash(uint32_t pixel) {
+    return ((pixel & 0xff) * 3 + (pixel >> 8 & 0xff) * 5 + (pixel >> 16 & 0xff) * 7 + (pixel >> 24) * 11) % 64;
+}
+
+static void putInt(std::vector<GLubyte> &out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+void encodeQOIBand(const ImageView &image, int y0, int y1, std::vector<GLubyte> &out) {
+    uint32_t index[64] = {};
+    uint32_t previous = 0;
+    int run = 0;
+    bool first = true;
+    
+    // No chunk is longer than a pixel's 4 byte RGB chunk, so the band fits in that much
+    size_t start = out.size();
+    out.resize(start + (size_t)image.width * (y1 - y0) * 4);
+    GLubyte *o = out.data() + start;
+    for (int y = y1 - 1; y >= y0; y--) {
+        for (int x = 0; x < image.width; x++) {
+            const GLubyte *p = image.pixel(x, y);
+            GLubyte r = p[0], g = p[image.channelStride], b = p[2 * image.channelStride];
+            uint32_t pixel = packPixel(r, g, b, 255);
+            if (pixel == previous && !first) {
+                if (++run == maxRun) {
+                    *o++ = opRun | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                *o++ = opRun | (run - 1);
+                run = 0;
+            }
+            
+            int hash = colorHash(pixel);
+            if (index[hash] == pixel)
+                *o++ = opIndex | hash;
+            else {
+                index[hash] = pixel;
+                // Differences wrap around, as the decoder adds them to the previous pixel modulo 256
+                signed char dr = r - (previous & 0xff), dg = g - (previous >> 8 & 0xff), db = b - (previous >> 16 & 0xff);
+                signed char drg = dr - dg, dbg = db - dg;
+                if (!first && dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                    *o++ = opDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                else if (!first && dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                    *o++ = opLuma | (dg + 32);
+                    *o++ = (drg + 8) << 4 | (dbg + 8);
+                }
+                else {
+                    *o++ = opRGB;
+                    *o++ = r;
+                    *o++ = g;
+                    *o++ = b;
+                }
+            }
+            previous = pixel;
+            first = false;
+        }
+    }
+    // Runs never continue into the next band
+    if (run > 0)
+        *o++ = opRun | (run - 1);
+    out.resize(o - out.data());
+}
+
+bool readQOIHeader(const GLubyte *header, size_t length, GLsizei *width, GLsizei *height) {
+    if (length < headerSize || header[0] != 'q' || header[1] != 'o' || header[2] != 'i' || header[3] != 'f')
+        return false;
+    uint32_t w = (uint32_t)header[4] << 24 | header[5] << 16 | header[6] << 8 | header[7];
+    uint32_t h = (uint32_t)header[8] << 24 | header[9] << 16 | header[10] << 8 | header[11];
+    // Sizes have to fit in a GLsizei, and in memory as RGB
+    if (w == 0 || h == 0 || w > 0x7fffffff || h > 0x7fffffff || (uint64_t)w * h > 0x7fffffff / 3)
+        return false;
+    if (header[12] != 3 && header[12] != 4)
+        return false;
+    *width = w;
+    *height = h;
+    return true;
+}
+
+GLubyte *decodeQOI(const std::vector<GLubyte> &data, GLsizei *width, GLsizei *height) {
+    GLsizei w, h;
+    if (!readQOIHeader(data.data(), data.size(), &w, &h))
+        return NULL;
+    
+    GLubyte *pixels = new GLubyte[(size_t)w * h * 3];
+    uint32_t index[64] = {};
+    uint32_t pixel = packPixel(0, 0, 0, 255);
+    size_t p = headerSize;
+    // Chunks stop where the end marker starts
+    size_t end = data.size() >= headerSize + sizeof(endMarker) ? data.size() - sizeof(endMarker) : headerSize;
+    int run = 0;
+    for (GLsizei y = h - 1; y >= 0; y--) {
+        GLubyte *row = pixels + (size_t)y * w * 3;
+        for (GLsizei x = 0; x < w; x++) {
+            if (run > 0)
+                run--;
+            else {
+                if (p >= end) {
+                    delete [] pixels;
+                    return NULL;
+                }
+                GLubyte b1 = data[p++];
+                GLubyte r = pixel & 0xff, g = pixel >> 8 & 0xff, b = pixel >> 16 & 0xff, a = pixel >> 24;
+                if (b1 == opRGB || b1 == opRGBA) {
+                    int length = b1 == opRGB ? 3 : 4;
+                    if (p + length > end) {
+                        delete [] pixels;
+                        return NULL;
+                    }
+                    r = data[p];
+                    g = data[p + 1];
+                    b = data[p + 2];
+                    if (b1 == opRGBA)
+                        a = data[p + 3];
+                    p += length;
+                    pixel = packPixel(r, g, b, a);
+                }
+                else if ((b1 & tagMask) == opIndex)
+                    pixel = index[b1];
+                else if ((b1 & tagMask) == opDiff)
+                    pixel = packPixel(r + ((b1 >> 4 & 3) - 2), g + ((b1 >> 2 & 3) - 2), b + ((b1 & 3) - 2), a);
+                else if ((b1 & tagMask) == opLuma) {
+                    if (p >= end) {
+                        delete [] pixels;
+                        return NULL;
+                    }
+                    GLubyte b2 = data[p++];
+                    int dg = (b1 & 0x3f) - 32;
+                    pixel = packPixel(r + dg - 8 + (b2 >> 4), g + dg, b + dg - 8 + (b2 & 0x0f), a);
+                }
+                else
+                    run = b1 & 0x3f;
+                index[colorHash(pixel)] = pixel;
+            }
+            row[x * 3] = pixel & 0xff;
+            row[x * 3 + 1] = pixel >> 8 & 0xff;
+            row[x * 3 + 2] = pixel >> 16 & 0xff;
+        }
+    }
+    *width = w;
+    *height = h;
+    return pixels;
+}
+
+QOIBandEncoder::QOIBandEncoder(const ImageView &view, const char *f) : ImageWriter(view, f) {
+    bands.resize((image.height + qoiBandRows - 1) / qoiBandRows);
+    bandsStarted = 0;
+}
+
+QOIBandEncoder::~QOIBandEncoder() {
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+void QOIBandEncoder::rowsFinished(int y) {
+    int first = bandsStarted;
+    while (bandsStarted < (int)bands.size() && (bandsStarted + 1) * qoiBandRows <= y)
+        bandsStarted++;
+    // The last band is usually shorter
+    if (y >= image.height)
+        bandsStarted = (int)bands.size();
+    if (bandsStarted == first)
+        return;
+    
+    int last = bandsStarted;
+    workers.push_back(std::thread([this, first, last] {
+        for (int i = first; i < last; i++) {
+            int y1 = (i + 1) * qoiBandRows < image.height ? (i + 1) * qoiBandRows : image.height;
+            encodeQOIBand(image, i * qoiBandRows, y1, bands[i]);
+        }
+    }));
+}
+
+bool QOIBandEncoder::write() {
+    // The bands left are shared by a thread per core
+    std::atomic<int> next(bandsStarted);
+    int numBands = (int)bands.size();
+    auto work = [&] {
+        for (int i = next++; i < numBands; i = next++) {
+            int y1 = (i + 1) * qoiBandRows < image.height ? (i + 1) * qoiBandRows : image.height;
+            encodeQOIBand(image, i * qoiBandRows, y1, bands[i]);
+        }
+    };
+    int threads = std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() : 1;
+    for (int t = 1; t < threads && bandsStarted + t < numBands; t++)
+        workers.push_back(std::thread(work));
+    work();
+    bandsStarted = numBands;
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    workers.clear();
+    
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (file == NULL) {
+        std::cout << filename << " cannot be written.\n";
+        return false;
+    }
+    std::vector<GLubyte> header;
+    header.push_back('q');
+    header.push_back('o');
+    header.push_back('i');
+    header.push_back('f');
+    putInt(header, image.width);
+    putInt(header, image.height);
+    header.push_back(3);    // channels
+    header.push_back(0);    // sRGB
+    bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+    
+    // The file goes from the top band down
+    for (int i = numBands - 1; i >= 0 && ok; i--)
+        ok = fwrite(bands[i].data(), 1, bands[i].size(), file) == bands[i].size();
+    ok = ok && fwrite(endMarker, 1, sizeof(endMarker), file) == sizeof(endMarker);
+    ok = fclose(file) == 0 && ok;
+    
+    if (!ok)
+        std::cout << filename << " cannot be written.\n";
+    return ok;
+}
@@ -0,0 +1,57 @@
+//
+//  QOICodec.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef QOICodec_hpp
+#define QOICodec_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <thread>
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include "ImageView.hpp"
+#include "ImageWriter.hpp"
+
+// Rows of the image each band of a qoi file holds
+// Every band starts with a full RGB pixel and an empty color index, so bands can be encoded on their own, in any order,
+// and still read back as one ordinary qoi stream: its only references to earlier pixels are to pixels of the same band
+static const int qoiBandRows = 64;
+
+// Encode the rows [y0, y1) of image as a qoi band, from the top row down like the file, appending it to out
+void encodeQOIBand(const ImageView &image, int y0, int y1, std::vector<GLubyte> &out);
+
+// Decode the qoi file in data into a new packed RGB array, bottom up like Image, and set width and height
+// Returns NULL if data is not a qoi file or is cut short
+GLubyte *decodeQOI(const std::vector<GLubyte> &data, GLsizei *width, GLsizei *height);
+
+// Read the width and height from the header of a qoi file, returns false if it isn't one
+bool readQOIHeader(const GLubyte *header, size_t length, GLsizei *width, GLsizei *height);
+
+// Encodes an image to a qoi file a band at a time, as the rows of each band are finished
+// Images are built from the bottom up and qoi files go from the top down, so the encoded bands are kept
+// until write, but encoding them happens on other threads while the rest of the image is still being made
+class QOIBandEncoder : public ImageWriter {
+private:
+    // Encoded bands, from the bottom of the image up, and how many of them have been handed to a thread
+    std::vector<std::vector<GLubyte> > bands;
+    int bandsStarted;
+    std::vector<std::thread> workers;
+public:
+    QOIBandEncoder(const ImageView &view, const char *f);
+    ~QOIBandEncoder();
+    // Encode every band the finished rows complete, on a thread of their own
+    void rowsFinished(int y);
+    // Encode the bands that are left, on every core, and write the file
+    bool write();
+};
+
+#endif /* QOICodec_hpp */
@@ -0,0 +1,321 @@
+//
+//  SelfCheck.cpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#include "SelfCheck.hpp"
+#include "Texture.hpp"
+#include "ImageWriter.hpp"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <random>
+#include <unistd.h>
+#include <dirent.h>
+
+// Each check returns why it failed, or an empty string if it passed
+typedef std::string (*Check)(const std::string &imagesDir);
+
+// Sum of the channel differences between the pixels at x0, y0 and x1, y1, wrapping around the edges
+static int pixelDifference(const ImageView &view, int x0, int y0, int x1, int y1) {
+    GLubyte a[3], b[3];
+    view.readPixel(x0, y0, EdgeWrap, a);
+    view.readPixel(x1, y1, EdgeWrap, b);
+    return abs(a[0] - b[0]) + abs(a[1] - b[1]) + abs(a[2] - b[2]);
+}
+
+// The right and top edges of a tileable texture are cut into its left and bottom edges, so neighbouring pixels
+// across the wrap differ about as much as neighbours inside it, unlike the unrelated pixels of an ordinary texture
+static std::string checkTileableWrap(const std::string &imagesDir) {
+    const char *images[2] = {"rice.ppm", "fakeGrass.ppm"};
+    for (int i = 0; i < 2; i++) {
+        std::string path = imagesDir + "/" + images[i];
+        SourceImage source(path.c_str(), 20, 5, 2);
+        if (!source.getError().empty())
+            return source.getError();
+        srand(1);
+        Texture texture(&source, 200, 200, true);
+        texture.generateTexture();
+        ImageView view = texture.getOutputImage()->view();
+        
+        long long inside = 0, across = 0;
+        long long numInside = 0, numAcross = 0;
+        for (int y = 0; y < view.height; y++) {
+            for (int x = 0; x < view.width; x++) {
+                int right = pixelDifference(view, x, y, x + 1, y);
+                int above = pixelDifference(view, x, y, x, y + 1);
+                (x == view.width - 1 ? across : inside) += right;
+                (x == view.width - 1 ? numAcross : numInside)++;
+                (y == view.height - 1 ? across : inside) += above;
+                (y == view.height - 1 ? numAcross : numInside)++;
+            }
+        }
+        double ratio = ((double)across / numAcross) / ((double)inside / numInside);
+        if (ratio > 2) {
+            std::ostringstream error;
+            error << "pixels across the wrap of a texture of " << images[i] << " differ " << ratio << " times as much as inside it";
+            return error.str();
+        }
+    }
+    return "";
+}
+
+// Whether two images have the same size and pixels
+static bool sameImages(Image *a, Image *b) {
+    if (a->width != b->width || a->height != b->height)
+        return false;
+    ImageView viewA = a->view(), viewB = b->view();
+    for (int y = 0; y < viewA.height; y++) {
+        for (int x = 0; x < viewA.width; x++) {
+            GLubyte rgbA[3], rgbB[3];
+            viewA.readPixel(x, y, EdgeZero, rgbA);
+            viewB.readPixel(x, y, EdgeZero, rgbB);
+            if (memcmp(rgbA, rgbB, 3) != 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+// A file for a check to write to and remove
+static std::string temporaryPath(const char *name) {
+    std::ostringstream path;
+    path << "/tmp/iq-check-" << getpid() << "-" << name;
+    return path.str();
+}
+
+// A saved layout recreates the same texture, for synthesis, tileable synthesis and transfer
+static std::string checkLayoutRoundTrip(const std::string &imagesDir) {
+    std::string sourcePath = imagesDir + "/rice.ppm", targetPath = imagesDir + "/potato.ppm";
+    SourceImage source(sourcePath.c_str(), 20, 5, 2);
+    Image target(targetPath.c_str());
+    if (!source.getError().empty())
+        return source.getError();
+    if (!target.getReadError().empty())
+        return target.getReadError();
+    
+    std::string layoutPath = temporaryPath("layout");
+    const char *kinds[3] = {"synthesized", "tileable", "transferred"};
+    for (int kind = 0; kind < 3; kind++) {
+        srand(1);
+        std::unique_ptr<Texture> generated(kind == 2 ? new Texture(&source, &target) : new Texture(&source, 150, 130, kind == 1));
+        generated->generateTexture();
+        bool saved = generated->saveLayout(layoutPath.c_str());
+        std::unique_ptr<Texture> loaded(kind == 2 ? new Texture(&source, &target) : new Texture(&source, 150, 130, kind == 1));
+        bool same = saved && loaded->loadLayout(layoutPath.c_str()) && sameImages(generated->getOutputImage(), loaded->getOutputImage());
+        unlink(layoutPath.c_str());
+        if (!same)
+            return (std::string)"a " + kinds[kind] + " texture isn't recreated by its saved layout";
+    }
+    return "";
+}
+
+// Reads of a rectangle that crosses the edges of an image, in every layout, get its own pixels inside it and
+// black outside, the right edge included, where a read once wrapped around to the start of the next row
+static std::string checkEdgeReads(const std::string &imagesDir) {
+    std::string path = imagesDir + "/potato.ppm";
+    Image packed(path.c_str());
+    if (!packed.getReadError().empty())
+        return packed.getReadError();
+    int w = packed.width, h = packed.height;
+    const GLubyte *data = packed.getData();
+    
+    const char *layoutNames[3] = {"packed", "rgbx", "planar"};
+    for (int layout = PackedRGB; layout <= PlanarRGBL; layout++) {
+        Image image(path.c_str(), (PixelLayout)layout);
+        // A rectangle a few pixels past each corner, and one along the right edge only
+        int rects[2][4] = {{-3, -3, w + 6, h + 6}, {w - 5, 10, 9, 20}};
+        for (int r = 0; r < 2; r++) {
+            int x0 = rects[r][0], y0 = rects[r][1], rw = rects[r][2], rh = rects[r][3];
+            std::vector<GLubyte> pixels((size_t)rw * rh * 3);
+            image.readPixels(x0, y0, rw, rh, pixels.data());
+            for (int y = 0; y < rh; y++) {
+                for (int x = 0; x < rw; x++) {
+                    int sx = x0 + x, sy = y0 + y;
+                    bool inside = sx >= 0 && sx < w && sy >= 0 && sy < h;
+                    GLubyte expected[3] = {0, 0, 0};
+                    if (inside)
+                        memcpy(expected, data + ((size_t)sy * w + sx) * 3, 3);
+                    if (memcmp(&pixels[((size_t)y * rw + x) * 3], expected, 3) != 0) {
+                        std::ostringstream error;
+                        error << "reading the " << layoutNames[layout] << " pixel at " << sx << ", " << sy << " of potato.ppm gives the wrong color";
+                        return error.str();
+                    }
+                }
+            }
+        }
+    }
+    return "";
+}
+
+// The contents of the file at path, empty if it can't be read
+static std::string readFile(const std::string &path) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// Sources held in every pixel layout choose the same blocks and seams, for every metric, synthesis and transfer
+static std::string checkPixelLayouts(const std::string &imagesDir) {
+    std::string sourcePath = imagesDir + "/rice.ppm", targetPath = imagesDir + "/potato.ppm";
+    Image target(targetPath.c_str());
+    if (!target.getReadError().empty())
+        return target.getReadError();
+    
+    const char *layoutNames[3] = {"packed", "rgbx", "planar"};
+    const char *metricNames[3] = {"magnitude", "squared", "luminance"};
+    std::string layoutPath = temporaryPath("layout");
+    for (int metric = 0; metric < 3; metric++) {
+        for (int transfer = 0; transfer < 2; transfer++) {
+            std::string packedLayout;
+            for (int layout = PackedRGB; layout <= PlanarRGBL; layout++) {
+                SourceImage source(sourcePath.c_str(), 20, 5, 2, 0, (PixelLayout)layout);
+                if (!source.getError().empty())
+                    return source.getError();
+                source.setErrorMetric((ErrorMetric)metric);
+                srand(1);
+                std::unique_ptr<Texture> texture(transfer ? new Texture(&source, &target) : new Texture(&source, 150, 130));
+                texture->generateTexture();
+                bool saved = texture->saveLayout(layoutPath.c_str());
+                std::string contents = readFile(layoutPath);
+                unlink(layoutPath.c_str());
+                if (!saved)
+                    return "the layout of a texture cannot be saved";
+                if (layout == PackedRGB)
+                    packedLayout = contents;
+                else if (contents != packedLayout)
+                    return (std::string)layoutNames[layout] + " sources choose different blocks than packed ones for " +
+                           (transfer ? "transfer" : "synthesis") + " with the " + metricNames[metric] + " metric";
+            }
+        }
+    }
+    return "";
+}
+
+// Batched errors choose the same blocks as scanning with the squared metric, which they replace, on a random source
+// Blocks are chosen at random among the 8 lowest errors, so the errors have to be ordered the same too
+static std::string checkBatchedErrors(const std::string &) {
+    const int size = 200, blockSize = 20, borderSize = 5;
+    std::string sourcePath = temporaryPath("random.ppm");
+    {
+        std::minstd_rand random;
+        std::ofstream file(sourcePath.c_str(), std::ios::binary);
+        file << "P6\n" << size << " " << size << "\n255\n";
+        for (int i = 0; i < size * size * 3; i++)
+            file.put((char)(random() % 256));
+    }
+    SourceImage source(sourcePath.c_str(), blockSize, borderSize, 8);
+    unlink(sourcePath.c_str());
+    if (!source.getError().empty())
+        return source.getError();
+    source.setErrorMetric(SquaredMagnitude);
+    
+    // Positions with every combination of neighbours, the ones to the right and above as when touching up a region
+    srand(1);
+    GLint numBlocks = source.getNumBlocks();
+    std::vector<BlockPlacement> placements;
+    std::vector<GLubyte> paths(64 * 2 * blockSize);
+    for (int p = 0; p < 64; p++) {
+        BlockPlacement place;
+        place.type = (BlockMatch)(p % 3);
+        place.sourceBlockLeft = rand() % numBlocks;
+        place.sourceBlockBottom = rand() % numBlocks;
+        place.borderPathLeft = &paths[2 * p * blockSize];
+        place.borderPathBottom = &paths[(2 * p + 1) * blockSize];
+        place.drawX = place.drawY = 0;
+        place.sourceBlockRight = p / 3 % 2 == 0 ? -1 : rand() % numBlocks;
+        place.sourceBlockTop = p / 6 % 2 == 0 ? -1 : rand() % numBlocks;
+        placements.push_back(place);
+    }
+    
+    std::vector<GLint> batched(placements.size()), scanned(placements.size());
+    if (!source.batchesErrors(NULL))
+        return "the squared metric doesn't batch errors";
+    srand(2);
+    source.findMinimumErrorBlocks(placements, NULL, batched.data());
+    source.setBatched(false);
+    srand(2);
+    source.findMinimumErrorBlocks(placements, NULL, scanned.data());
+    for (size_t p = 0; p < placements.size(); p++) {
+        if (batched[p] != scanned[p]) {
+            std::ostringstream error;
+            error << "batched errors choose block " << batched[p] << " instead of " << scanned[p] << " for position " << p;
+            return error.str();
+        }
+    }
+    return "";
+}
+
+// Every bundled image comes back unchanged from a qoi file, and from a ppm file written a few rows at a time
+static std::string checkFileRoundTrip(const std::string &imagesDir) {
+    std::vector<std::string> names;
+    DIR *dir = opendir(imagesDir.c_str());
+    if (dir == NULL)
+        return imagesDir + " cannot be read.";
+    while (dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && (name.compare(name.size() - 4, 4, ".ppm") == 0 || name.compare(name.size() - 4, 4, ".bmp") == 0))
+            names.push_back(name);
+    }
+    closedir(dir);
+    if (names.empty())
+        return "there are no ppm or bmp images in " + imagesDir;
+    
+    for (size_t i = 0; i < names.size(); i++) {
+        Image image((imagesDir + "/" + names[i]).c_str());
+        if (!image.getReadError().empty())
+            return image.getReadError();
+        const char *extensions[2] = {"qoi", "ppm"};
+        for (int e = 0; e < 2; e++) {
+            std::string path = temporaryPath((std::string("image.") + extensions[e]).c_str());
+            ImageWriter *writer = createImageWriter(image.view(), path.c_str());
+            for (int y = 0; y < image.height; y += 37)
+                writer->rowsFinished(y);
+            bool written = writer->write();
+            delete writer;
+            Image copy(path.c_str());
+            unlink(path.c_str());
+            if (!written || !sameImages(&image, &copy))
+                return names[i] + " changes when written to a " + extensions[e] + " file and read back";
+        }
+    }
+    return "";
+}
+
+struct SelfCheck {
+    const char *name;
+    Check check;
+};
+
+static const SelfCheck selfChecks[] = {
+    {"tileable textures wrap around seamlessly", checkTileableWrap},
+    {"saved layouts recreate their textures", checkLayoutRoundTrip},
+    {"reads past the edges of an image are black", checkEdgeReads},
+    {"every pixel layout chooses the same blocks", checkPixelLayouts},
+    {"batched errors choose the same blocks as scans", checkBatchedErrors},
+    {"images are written and read back unchanged", checkFileRoundTrip},
+};
+
+bool runSelfChecks(const std::string &imagesDir) {
+    bool passed = true;
+    for (size_t i = 0; i < sizeof(selfChecks) / sizeof(selfChecks[0]); i++) {
+        // The progress the checks print would bury the results
+        std::streambuf *output = std::cout.rdbuf(NULL);
+        std::string error = selfChecks[i].check(imagesDir);
+        std::cout.rdbuf(output);
+        std::cout.clear();
+        
+        std::cout << (error.empty() ? "ok      " : "FAILED  ") << selfChecks[i].name << "\n";
+        if (!error.empty())
+            std::cout << "        " << error << "\n";
+        passed = passed && error.empty();
+    }
+    return passed;
+}
@@ -0,0 +1,18 @@
+//
+//  SelfCheck.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef SelfCheck_hpp
+#define SelfCheck_hpp
+
+#include <stdio.h>
+#include <string>
+
+// Run every check of the synthesis code on the bundled images in imagesDir, printing whether each one passed
+// Returns false if any of them failed
+bool runSelfChecks(const std::string &imagesDir);
+
+#endif /* SelfCheck_hpp */
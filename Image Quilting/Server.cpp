@@ -0,0 +1,373 @@
+//
+//  Server.cpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#include "Server.hpp"
+#include "Texture.hpp"
+#include "Image.hpp"
+#include "AutoTuner.hpp"
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Largest request frame that will be read
+static const uint32_t maxRequestSize = 64 * 1024;
+// Most connections kept open at once, more wait in the listen backlog
+static const int maxConnections = 256;
+// Longest a worker waits on a client partway through a request or a response
+static const int ioTimeoutSeconds = 5;
+
+// Read or write exactly size bytes, returns false if the connection closed or failed
+static bool readFully(int fd, void *buffer, size_t size) {
+    char *ptr = (char *)buffer;
+    while (size > 0) {
+        ssize_t n = read(fd, ptr, size);
+        if (n <= 0)
+            return false;
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const void *buffer, size_t size) {
+    const char *ptr = (const char *)buffer;
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n <= 0)
+            return false;
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Write a frame made of a header followed by body
+static bool writeFrame(int fd, const std::string &header, const std::vector<GLubyte> &body) {
+    uint32_t size = (uint32_t)(header.size() + body.size());
+    GLubyte length[4] = {(GLubyte)(size >> 24), (GLubyte)(size >> 16), (GLubyte)(size >> 8), (GLubyte)size};
+    return writeFully(fd, length, 4) && writeFully(fd, header.data(), header.size()) && writeFully(fd, body.data(), body.size());
+}
+
+Server::Server(const char *path, int workers, int queueSize, int cacheS, const std::string &outputDirectory, const std::string &tuningFile) {
+    socketPath = path;
+    outputDir = outputDirectory;
+    tuningPath = tuningFile;
+    numWorkers = workers < 1 ? 1 : workers;
+    maxQueued = queueSize < 1 ? 1 : queueSize;
+    cacheSize = cacheS < 1 ? 1 : cacheS;
+}
+
+bool Server::run() {
+    // Clients that hang up early shouldn't kill the server
+    signal(SIGPIPE, SIG_IGN);
+    
+    // Files are written relative to the output directory as it is now
+    if (!outputDir.empty()) {
+        char resolved[PATH_MAX];
+        if (realpath(outputDir.c_str(), resolved) == NULL) {
+            std::cout << outputDir << " cannot be written to: " << strerror(errno) << "\n";
+            return false;
+        }
+        outputDir = resolved;
+    }
+    
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cout << socketPath << " is too long for a socket path.\n";
+        return false;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+    
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (listenFd < 0 || bind(listenFd, (sockaddr *)&address, sizeof(address)) < 0 || listen(listenFd, maxQueued) < 0 || pipe(wakePipe) < 0) {
+        std::cout << socketPath << " cannot be listened on: " << strerror(errno) << "\n";
+        return false;
+    }
+    fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+    std::cout << "Serving on " << socketPath << " with " << numWorkers << " workers";
+    if (!outputDir.empty())
+        std::cout << ", writing files to " << outputDir;
+    std::cout << "\n";
+    
+    // Calibrating takes about half a second, which no job should wait for
+    tuning = loadOrCalibrate(tuningPath);
+    
+    for (int i = 0; i < numWorkers; i++)
+        std::thread(&Server::workerLoop, this).detach();
+    
+    // Connections waiting for their next request
+    std::vector<int> idle;
+    while (true) {
+        bool full;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            idle.insert(idle.end(), answered.begin(), answered.end());
+            answered.clear();
+            full = (int)queue.size() >= maxQueued;
+        }
+        
+        // Back-pressure: once maxQueued requests are waiting for a worker, neither new connections nor new
+        // requests are taken until one is, so clients wait in the listen backlog or their socket buffers
+        std::vector<pollfd> fds;
+        pollfd wake = {wakePipe[0], POLLIN, 0};
+        fds.push_back(wake);
+        if (!full) {
+            pollfd listening = {listenFd, POLLIN, 0};
+            if ((int)idle.size() < maxConnections)
+                fds.push_back(listening);
+            for (size_t i = 0; i < idle.size(); i++) {
+                pollfd connection = {idle[i], POLLIN, 0};
+                fds.push_back(connection);
+            }
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0)
+            continue;
+        
+        char drain[64];
+        while (read(wakePipe[0], drain, sizeof(drain)) > 0);
+        std::vector<int> ready, stillIdle;
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (fds[i].fd == listenFd) {
+                if (fds[i].revents & POLLIN) {
+                    int fd = accept(listenFd, NULL, NULL);
+                    if (fd >= 0) {
+                        // A request that stops halfway, or a client that stops reading its response,
+                        // only holds a worker this long
+                        timeval timeout = {ioTimeoutSeconds, 0};
+                        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                        stillIdle.push_back(fd);
+                    }
+                }
+            }
+            // A request, or the client hanging up, which the worker finds out when it reads
+            else if (fds[i].revents != 0)
+                ready.push_back(fds[i].fd);
+            else
+                stillIdle.push_back(fds[i].fd);
+        }
+        if (full)
+            continue;
+        idle = stillIdle;
+        
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.insert(queue.end(), ready.begin(), ready.end());
+        if (!ready.empty())
+            queueChanged.notify_all();
+    }
+}
+
+void Server::wakePoller() {
+    char byte = 0;
+    (void)write(wakePipe[1], &byte, 1);
+}
+
+void Server::workerLoop() {
+    while (true) {
+        int fd;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueChanged.wait(lock, [this] { return !queue.empty(); });
+            fd = queue.front();
+            queue.pop_front();
+        }
+        // There is room in the queue again
+        wakePoller();
+        
+        if (handleRequest(fd)) {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            answered.push_back(fd);
+        }
+        else
+            close(fd);
+        wakePoller();
+    }
+}
+
+// Answer one request on fd, returns false if the connection closed or failed and should be closed
+bool Server::handleRequest(int fd) {
+    GLubyte length[4];
+    if (!readFully(fd, length, 4))
+        return false;
+    uint32_t size = ((uint32_t)length[0] << 24) | ((uint32_t)length[1] << 16) | ((uint32_t)length[2] << 8) | length[3];
+    if (size > maxRequestSize) {
+        writeFrame(fd, "ERROR Request is too large.\n", std::vector<GLubyte>());
+        return false;
+    }
+    std::string request(size, '\0');
+    if (!readFully(fd, &request[0], size))
+        return false;
+    
+    std::vector<GLubyte> pixels;
+    std::string header = runJob(request, pixels);
+    return writeFrame(fd, header, pixels);
+}
+
+// Get the prepared source image for job, from the cache if it is there and the file hasn't changed
+std::shared_ptr<SourceImage> Server::getSource(const Job &job) {
+    std::string key = job.sourceKey();
+    struct stat info;
+    time_t modified = stat(job.sourcePath.c_str(), &info) == 0 ? info.st_mtime : 0;
+    
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        for (auto it = cache.begin(); it != cache.end(); it++) {
+            if (it->key == key && it->modified == modified) {
+                // Move to the front, it is now the most recently used
+                cache.splice(cache.begin(), cache, it);
+                return cache.front().source;
+            }
+        }
+    }
+    
+    // Prepare the source outside of the lock so other jobs can keep using the cache
+    std::shared_ptr<SourceImage> source(new SourceImage(job.sourcePath.c_str(), job.blockSize, job.borderSize, job.randomness, sourceMemoryBytes(job), job.pixelLayout));
+    // Sources that couldn't be read aren't cached, the file may be fixed before the next job
+    if (!source->getError().empty())
+        return source;
+    source->setErrorMetric(job.metric);
+    
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    for (auto it = cache.begin(); it != cache.end(); it++) {
+        if (it->key == key) {
+            cache.erase(it);
+            break;
+        }
+    }
+    CachedSource entry = {key, modified, source};
+    cache.push_front(entry);
+    // Jobs still using evicted sources keep them alive until they finish
+    while (cache.size() > cacheSize)
+        cache.pop_back();
+    return source;
+}
+
+// Check path is relative and inside the output directory, and make it absolute
+bool Server::resolveOutputPath(std::string &path, std::string &error) {
+    if (outputDir.empty()) {
+        error = "This server doesn't write files, start it with --output-dir to allow them.";
+        return false;
+    }
+    if (path[0] == '/' || path == ".." || path.compare(0, 3, "../") == 0 || path.find("/../") != std::string::npos || (path.size() >= 3 && path.compare(path.size() - 3, 3, "/..") == 0)) {
+        error = path + " has to be a path inside the output directory.";
+        return false;
+    }
+    path = outputDir + "/" + path;
+    
+    // The directory it goes in has to exist, and symlinks can't lead out of the output directory
+    std::string directory = path.substr(0, path.find_last_of('/'));
+    char resolved[PATH_MAX];
+    if (realpath(directory.c_str(), resolved) == NULL) {
+        error = directory + " doesn't exist.";
+        return false;
+    }
+    std::string real = resolved;
+    if (real != outputDir && real.compare(0, outputDir.size() + 1, outputDir + "/") != 0) {
+        error = path + " has to be a path inside the output directory.";
+        return false;
+    }
+    return true;
+}
+
+// Run the job in request, returns the response header and fills pixels if they should be sent back
+std::string Server::runJob(const std::string &request, std::vector<GLubyte> &pixels) {
+    std::vector<std::string> args;
+    std::istringstream lines(request);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (!line.empty())
+            args.push_back(line);
+    }
+    
+    Job job;
+    std::string error;
+    if (!parseJob(args, job, error) || !checkJob(job, error))
+        return "ERROR " + error + "\n";
+    // Tiled jobs start processes and write tiles, which is for the command line
+    if (job.isTiled())
+        return "ERROR Tiled jobs cannot be run by the server.\n";
+    // Calibration is done once, when the server starts
+    if (!job.tuningPath.empty())
+        return "ERROR --tuning is set when the server starts, not by jobs.\n";
+    if ((!job.outputPath.empty() && !resolveOutputPath(job.outputPath, error)) || (!job.saveLayoutPath.empty() && !resolveOutputPath(job.saveLayoutPath, error)))
+        return "ERROR " + error + "\n";
+    
+    std::shared_ptr<SourceImage> source = getSource(job);
+    if (!source->getError().empty())
+        return "ERROR " + source->getError() + "\n";
+    std::unique_ptr<Image> targetImage;
+    std::unique_ptr<Texture> texture;
+    if (job.isTransfer()) {
+        targetImage.reset(new Image(job.targetPath.c_str()));
+        if (!targetImage->getReadError().empty())
+            return "ERROR " + targetImage->getReadError() + "\n";
+        texture.reset(new Texture(source.get(), targetImage.get()));
+    }
+    else
+        texture.reset(new Texture(source.get(), job.width, job.height, job.tileable));
+    texture->setSearch(job.search);
+    texture->setDeadline(job.deadline);
+    // The source is shared with other jobs, which already keep every worker busy, so only the search is tuned;
+    // exhaustive search batches errors whenever the source can, as it does without tuning
+    if (job.autoSearch && job.loadLayoutPath.empty()) {
+        TuningChoice choice = tuneTexture(tuning, source.get(), texture.get(), 1);
+        choice.batched = choice.search == ExhaustiveSearch && source->batchesErrors(targetImage.get());
+        texture->setSearch(choice.search);
+        std::cout << describeTuning(choice) + "\n";
+    }
+    
+    if (!job.loadLayoutPath.empty()) {
+        if (!texture->loadLayout(job.loadLayoutPath.c_str()))
+            return "ERROR " + job.loadLayoutPath + " cannot be loaded.\n";
+    }
+    else
+        texture->generateTexture();
+    // Pages that couldn't be read were left black, and the file may have changed under the cached source
+    if (source->pageReadFailed()) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        for (auto it = cache.begin(); it != cache.end(); it++) {
+            if (it->source == source) {
+                cache.erase(it);
+                break;
+            }
+        }
+        return "ERROR " + job.sourcePath + " could not be read.\n";
+    }
+    if (!job.saveLayoutPath.empty() && !texture->saveLayout(job.saveLayoutPath.c_str()))
+        return "ERROR " + job.saveLayoutPath + " cannot be written.\n";
+    
+    Image *output = texture->getOutputImage();
+    std::ostringstream header;
+    header << "OK " << output->width << " " << output->height << "\n";
+    if (!job.outputPath.empty()) {
+        if (!output->writeFile(job.outputPath.c_str()))
+            return "ERROR " + job.outputPath + " cannot be written.\n";
+        return header.str();
+    }
+    
+    // Send rows from the top down, like a ppm file
+    int rowSize = output->width * 3;
+    pixels.resize(rowSize * output->height);
+    for (int y = 0; y < output->height; y++)
+        memcpy(&pixels[y * rowSize], output->getData() + (output->height - 1 - y) * rowSize, rowSize);
+    return header.str();
+}
@@ -0,0 +1,74 @@
+//
+//  Server.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef Server_hpp
+#define Server_hpp
+
+#include <stdio.h>
+#include <string>
+#include <list>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <time.h>
+#include "SourceImage.hpp"
+#include "Job.hpp"
+#include "AutoTuner.hpp"
+
+// Long running server that takes jobs over a UNIX domain socket
+// Every message in either direction is a frame: a 4 byte big endian length, then that many bytes
+// A request frame holds the same arguments as the command line, one per line
+// The response frame starts with "OK <width> <height>\n" followed by the texture as RGB bytes from the top row down,
+// or just "OK <width> <height>\n" if the job has an --output path, or "ERROR <message>\n"
+// A connection can send any number of requests, each one gets a response before the next is read
+// Idle connections wait in a poller, not in a worker: a connection only goes to the queue for a worker once a
+// request arrives on it, and goes back to the poller once it is answered
+// Files are only written for --output and --save-layout paths inside the server's output directory
+class Server {
+private:
+    struct CachedSource {
+        std::string key;
+        time_t modified;
+        std::shared_ptr<SourceImage> source;
+    };
+    
+    std::string socketPath, outputDir, tuningPath;
+    int numWorkers, maxQueued;
+    size_t cacheSize;
+    // Measured speeds of this machine for --search auto, loaded or calibrated before any job is served
+    CostModel tuning;
+    
+    // Connections with a request waiting for a worker, never more than maxQueued,
+    // and connections workers have answered, for the poller to wait on again
+    std::deque<int> queue;
+    std::vector<int> answered;
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    // Written to by workers to wake the poller when they take a request or answer one
+    int wakePipe[2];
+    
+    // Prepared source images, most recently used first
+    std::list<CachedSource> cache;
+    std::mutex cacheMutex;
+    
+    std::shared_ptr<SourceImage> getSource(const Job &job);
+    void workerLoop();
+    void wakePoller();
+    bool handleRequest(int fd);
+    bool resolveOutputPath(std::string &path, std::string &error);
+    std::string runJob(const std::string &request, std::vector<GLubyte> &pixels);
+public:
+    // outputDir is where jobs may write files, empty to write none; tuningFile is where the measurements for
+    // --search auto are kept, empty for the default path
+    Server(const char *path, int workers, int queueSize, int cacheS, const std::string &outputDirectory, const std::string &tuningFile);
+    // Listen on the socket and serve jobs forever, returns false if the socket could not be opened
+    bool run();
+};
+
+#endif /* Server_hpp */
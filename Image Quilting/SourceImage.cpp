@@ -8,37 +8,87 @@
 
 #include "SourceImage.hpp"
 #include <random>
+#include <cstring>
+#include <algorithm>
 #include <math.h>
 #include <iostream>
 #include <cstdlib>
 #include <ctime>
 #include <time.h>
+#include <climits>
+#include <thread>
+#include <atomic>
+
+// Random blocks a PatchMatch search tries at a position that has no block yet
+static const int patchMatchRandomStarts = 4;
 
 // Create a source image object with a file source, block size, border size and randomness
-SourceImage::SourceImage(const char *filename, GLsizei blockS, GLsizei borderS, GLint randomness) {
-    // Create the underlying image
-    image = new Image(filename);
-    
+// Sources that can't be read are left without blocks, and getError says why
+SourceImage::SourceImage(const char *filename, GLsizei blockS, GLsizei borderS, GLint randomness, size_t memoryCap, PixelLayout layout) {
     blockSize = blockS;
     borderSize = borderS;
+    image = NULL;
+    tiles = NULL;
+    pixelLayout = PackedRGB;
+    width = height = 0;
+    
+    // Border paths are stored as one byte per pixel row
+    if (borderSize < 1 || borderSize > 256 || borderSize >= blockSize) {
+        error = "Border size must be between 1 and 256 and less than block size.";
+        std::cout << error << "\n";
+    }
+    // Create the underlying image, or open it to be read a page at a time
+    // Pages are always packed RGB
+    else if (memoryCap > 0) {
+        tiles = new TiledSource(filename, blockSize, borderSize, memoryCap);
+        error = tiles->getError();
+        width = tiles->width;
+        height = tiles->height;
+    }
+    else {
+        image = new Image(filename, layout);
+        error = image->getReadError();
+        pixelLayout = layout;
+        width = image->width;
+        height = image->height;
+    }
+    // Random blocks are picked from all but the last column and row, so there have to be at least two of each
+    if (error.empty() && (width < 2 * blockSize - borderSize || height < 2 * blockSize - borderSize)) {
+        error = (std::string)filename + " is smaller than two overlapping blocks on each side.";
+        std::cout << error << "\n";
+    }
     
     // must have at least one column
     // then add as many (blockSize - borderSize) pieces as will fit
-    numCols = 1 + ((image->width - blockSize) / (blockSize - borderSize));
-    
     // same idea for rows
-    numRows = 1 + ((image->height - blockSize) / (blockSize - borderSize));
-    
-    std::cout << "Source Image: numCols:" << numCols << " numRows:" << numRows << "\n";
+    if (error.empty()) {
+        numCols = 1 + ((width - blockSize) / (blockSize - borderSize));
+        numRows = 1 + ((height - blockSize) / (blockSize - borderSize));
+        std::cout << "Source Image: numCols:" << numCols << " numRows:" << numRows << "\n";
+    }
+    else
+        numCols = numRows = 0;
     
     blockChoosingRandomness = randomness;
-
+    if (blockChoosingRandomness < 1)
+        blockChoosingRandomness = 1;
+    
+    batched = true;
+    scanThreads = 1;
+    scanChunk = 256;
+    for (int side = LeftStrip; side <= TopStrip; side++)
+        strips[side] = NULL;
+    setErrorMetric(Magnitude);
+    
     // Seed the randomness
     srand((unsigned)time(0));
 }
 
 SourceImage::~SourceImage() {
     delete image;
+    delete tiles;
+    for (int side = LeftStrip; side <= TopStrip; side++)
+        delete strips[side];
 }
 
 // position of block is [col * (blockSize - borderSize), row * (blockSize - borderSize)]
@@ -50,6 +100,17 @@ GLint SourceImage::posY(GLint row) {
     return row * (blockSize - borderSize);
 }
 
+// Choose how pixel errors are measured, and the scan and seam kernels for it
+// Kernels are picked once here, so the scans and seams don't branch on the kind of matching, the metric, the pixel layout or the block size
+void SourceImage::setErrorMetric(ErrorMetric metric) {
+    errorMetric = metric;
+    for (int type = Right; type <= None; type++) {
+        scanKernels[type][0] = selectScanKernel((BlockMatch)type, false, metric, pixelLayout, blockSize, borderSize);
+        scanKernels[type][1] = selectScanKernel((BlockMatch)type, true, metric, pixelLayout, blockSize, borderSize);
+    }
+    selectSeamKernels(metric, blockSize, borderSize, seamErrorKernels, &cutKernel);
+}
+
 GLint SourceImage::getRandomBlock() {
     return rand()%((numCols-1) * (numRows-1));
 }
@@ -60,229 +121,480 @@ GLint SourceImage::getRandomBlock() {
 //         type - the type of matching (Right, Top, or Both)
 // Returns: the index of the chosen block to place after the matching process
 //          and fills borderPathLeft and borderPathBottom with best border paths
-GLint SourceImage::findMinimumErrorBlock(int sourceBlockLeft, int sourceBlockBottom, BlockMatch type, int *borderPathLeft, int *borderPathBottom, Image *targetImage, int drawX, int drawY) {
-    GLint borderArea = borderSize * blockSize * 3, blockArea = blockSize * blockSize * 3;
-    GLint error = 0;
+// For tileable textures, sourceBlockRight and sourceBlockTop are the blocks that wrap around to the right of and above
+// the new block (-1 for none), whose left/bottom borders are also tested against the new block's right/top borders
+GLint SourceImage::findMinimumErrorBlock(int sourceBlockLeft, int sourceBlockBottom, BlockMatch type, GLubyte *borderPathLeft, GLubyte *borderPathBottom, Image *targetImage, int drawX, int drawY, int sourceBlockRight, int sourceBlockTop) {
     GLint totalNumBlocks = numCols * numRows;
-    GLubyte *sourceRightBorder = NULL, *sourceTopBorder = NULL, *targetBorder, *sourceBlock = NULL, *targetBlock = NULL;
-    if (type == Right || type == Both)
-        sourceRightBorder = new GLubyte[borderArea];
-    if (type == Top || type == Both)
-        sourceTopBorder = new GLubyte[borderArea];
-    if (targetImage != NULL) {
-        sourceBlock = new GLubyte[blockArea];
-        targetBlock = new GLubyte[blockArea];
-    }
-    targetBorder = new GLubyte[borderArea];
     
-    // Get pixels of sourceBlock's appropriate border and store in sourceBorder
-    GLint col = sourceBlockLeft % numCols;
-    GLint row = sourceBlockLeft / numCols;
-    if (type == Right || type == Both) {
-        // Right border of source block begins where block to right starts
-        image->readPixels(posX(col + 1), posY(row), borderSize, blockSize, sourceRightBorder);
-    }
-    col = sourceBlockBottom % numCols;
-    row = sourceBlockBottom / numCols;
-    if (type == Top || type == Both) {
-        // Top border of source block begins where block above starts
-        image->readPixels(posX(col), posY(row+1), blockSize, borderSize, sourceTopBorder);
-    }
+    // Compare the borders with the appropriate borders of every block in the image
+    ScanInput input;
+    TiledSource::Page pages[4];
+    prepareScan(input, pages, sourceBlockLeft, sourceBlockBottom, type, targetImage, drawX, drawY, sourceBlockRight, sourceBlockTop);
+    input.numBlocks = totalNumBlocks;
+    std::vector<long long> errors(totalNumBlocks);
+    scan(scanKernels[type][targetImage != NULL], input, errors.data());
+    releaseScan(input);
     
+    GLint chosen = chooseBlock(errors.data(), totalNumBlocks);
+    
+    // Calculate minimum error border paths for the chosen block
+    getBorderPaths(chosen, sourceBlockLeft, sourceBlockBottom, type, borderPathLeft, borderPathBottom, targetImage, drawX, drawY);
+    
+    return chosen;
+}
+
+// Choose randomly from the blockChoosingRandomness blocks with the lowest errors, given the errors of count blocks
+// Returns which of the count blocks was chosen
+int SourceImage::chooseBlock(const long long *errors, int count) {
     struct errorBlock {
         GLint index;
-        GLint error;
+        long long error;
     };
     
-    std::vector<errorBlock> possibleBlocks;
+    std::vector<errorBlock> possibleBlocks(count);
+    for (int i = 0; i < count; i++) {
+        possibleBlocks[i].index = i;
+        possibleBlocks[i].error = errors[i];
+    }
     
-    // Compare sourceBorder with the appropriate border of every block in the image
-    for (int i = 0; i < totalNumBlocks; i++) {
-        
-        col = i % numCols;
-        row = i / numCols;
-        
-        error = 0;
-        
-        // If a target image was given, consider proper target image block in error calculation
-        if (targetImage != NULL) {
-            // Put target block data in targetBorder and source block data in sourceBlock
-            targetImage->readPixels(drawX, drawY, blockSize, blockSize, targetBlock);
-            image->readPixels(posX(col), posY(row), blockSize, blockSize, sourceBlock);
-            // Add luminance difference of each pixel to error
-            for (int p = 0; p < blockArea; p += 3) {
-                int targetLuminance = pixelLuminance(targetBlock[p], targetBlock[p+1], targetBlock[p+2]);
-                int sourceLuminance = pixelLuminance(sourceBlock[p], sourceBlock[p+1], sourceBlock[p+2]);
-                error += abs(targetLuminance - sourceLuminance);
-            }
+    // Sort the lowest error blocks to the front so we can choose from them
+    int poolSize = blockChoosingRandomness < count ? blockChoosingRandomness : count;
+    auto sortErrorBlocks = [](const errorBlock &a, const errorBlock &b) { return a.error < b.error; };
+    std::partial_sort(possibleBlocks.begin(), possibleBlocks.begin() + poolSize, possibleBlocks.end(), sortErrorBlocks);
+    int chosenBlock = rand()%(poolSize);
+    return possibleBlocks[chosenBlock].index;
+}
+
+// Params: samples - how many random blocks to compare, all of them if at least the number of blocks,
+//                   or 0 to take one random block without cutting border paths
+//         place, targetImage - as for findMinimumErrorBlock
+// Fewer samples find worse blocks in less time, for textures that have to be generated within a deadline
+GLint SourceImage::findSampledBlock(int samples, const BlockPlacement &place, Image *targetImage, long long &error) {
+    GLint totalNumBlocks = numCols * numRows;
+    std::vector<GLint> candidates;
+    if (samples < totalNumBlocks) {
+        for (int i = 0; i < samples || i == 0; i++)
+            candidates.push_back(rand() % totalNumBlocks);
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    }
+    
+    ScanInput input;
+    TiledSource::Page pages[4];
+    prepareScan(input, pages, place.sourceBlockLeft, place.sourceBlockBottom, place.type, targetImage, place.drawX, place.drawY, place.sourceBlockRight, place.sourceBlockTop);
+    input.candidates = candidates.empty() ? NULL : candidates.data();
+    input.numBlocks = candidates.empty() ? totalNumBlocks : (GLint)candidates.size();
+    std::vector<long long> errors(input.numBlocks);
+    scan(scanKernels[place.type][targetImage != NULL], input, errors.data());
+    releaseScan(input);
+    
+    int chosen = chooseBlock(errors.data(), input.numBlocks);
+    error = errors[chosen];
+    GLint index = candidates.empty() ? chosen : candidates[chosen];
+    if (samples > 0)
+        getBorderPaths(index, place.sourceBlockLeft, place.sourceBlockBottom, place.type, place.borderPathLeft, place.borderPathBottom, targetImage, place.drawX, place.drawY);
+    else {
+        if (place.borderPathLeft != NULL)
+            memset(place.borderPathLeft, 0, blockSize);
+        if (place.borderPathBottom != NULL)
+            memset(place.borderPathBottom, 0, blockSize);
+    }
+    return index;
+}
+
+// The strip on side of every block, read from the source the first time it is needed
+const StripMatrix &SourceImage::stripMatrix(StripSide side) {
+    std::lock_guard<std::mutex> lock(stripMutex);
+    if (strips[side] == NULL)
+        strips[side] = new StripMatrix(image->view(), numCols, numCols * numRows, blockSize - borderSize, blockSize, borderSize, side);
+    return *strips[side];
+}
+
+// Whether findMinimumErrorBlocks finds the errors of a batch of positions at once, instead of scanning for each one
+bool SourceImage::batchesErrors(Image *targetImage) {
+    // The luminance error of texture transfer and the other metrics aren't sums of products, so they are scanned
+    // Paged sources are scanned too, since the strips of a whole source may not fit in their memory cap
+    if (!batched || errorMetric != SquaredMagnitude || targetImage != NULL || tiles != NULL)
+        return false;
+    // Products of strips are summed in 32 bits
+    return (long long)blockSize * borderSize * 3 * 255 * 255 <= INT_MAX;
+}
+
+// Params: placements - positions whose neighbours have all been chosen, none of them neighbours of each other,
+//         like the positions along an anti-diagonal of the texture
+// The squared error of a block at a position is the sum, over the sides it overlaps a neighbour on,
+// of |a|^2 + |b|^2 - 2 a.b for the neighbour's strip a and the block's strip b, the same sum the scan kernels make
+// Every position that overlaps a neighbour on the same side is multiplied with that side's strips at once,
+// so each strip of the source is read once per batch instead of once per position
+// Blocks are chosen from the errors in the order of placements, as calling findMinimumErrorBlock for each would
+void SourceImage::findMinimumErrorBlocks(const std::vector<BlockPlacement> &placements, Image *targetImage, GLint *chosen) {
+    if (!batchesErrors(targetImage)) {
+        for (size_t p = 0; p < placements.size(); p++) {
+            const BlockPlacement &place = placements[p];
+            chosen[p] = findMinimumErrorBlock(place.sourceBlockLeft, place.sourceBlockBottom, place.type, place.borderPathLeft, place.borderPathBottom, targetImage, place.drawX, place.drawY, place.sourceBlockRight, place.sourceBlockTop);
         }
-        
-        if (type == Right || type == Both) {
-            // Get the area of the left border of the target block to compare and store in targetBorder
-            image->readPixels(posX(col), posY(row), borderSize, blockSize, targetBorder);
-            // Compare each pixel of sourceBorder and targetBorder
-            for (int p = 0; p < borderArea; p+=3) {
-                int rDif = sourceRightBorder[p] - targetBorder[p];
-                int gDif = sourceRightBorder[p+1] - targetBorder[p+1];
-                int bDif = sourceRightBorder[p+2] - targetBorder[p+2];
-                int magnitude = sqrt(rDif * rDif + gDif * gDif + bDif * bDif);
-                error += magnitude;
+        return;
+    }
+    
+    GLint totalNumBlocks = numCols * numRows;
+    std::vector<long long> errors(placements.size() * totalNumBlocks, 0);
+    std::vector<GLshort> neighbourStrips;
+    std::vector<GLint> products;
+    std::vector<size_t> positions;
+    for (int side = LeftStrip; side <= TopStrip; side++) {
+        // The neighbour each position overlaps on this side, if it has one
+        positions.clear();
+        std::vector<GLint> neighbours;
+        for (size_t p = 0; p < placements.size(); p++) {
+            const BlockPlacement &place = placements[p];
+            GLint neighbour = -1;
+            if (side == LeftStrip && (place.type == Right || place.type == Both))
+                neighbour = place.sourceBlockLeft;
+            else if (side == BottomStrip && (place.type == Top || place.type == Both))
+                neighbour = place.sourceBlockBottom;
+            else if (side == RightStrip)
+                neighbour = place.sourceBlockRight;
+            else if (side == TopStrip)
+                neighbour = place.sourceBlockTop;
+            if (neighbour >= 0) {
+                positions.push_back(p);
+                neighbours.push_back(neighbour);
             }
         }
+        if (positions.empty())
+            continue;
         
-        if (type == Top || type == Both) {
-            // Get the area of the bottom border of the target block to compare and store in targetBorder
-            image->readPixels(posX(col), posY(row), blockSize, borderSize, targetBorder);
-            // Compare each pixel of sourceBorder and targetBorder
-            for (int p = 0; p < borderArea; p+=3) {
-                int rDif = sourceTopBorder[p] - targetBorder[p];
-                int gDif = sourceTopBorder[p+1] - targetBorder[p+1];
-                int bDif = sourceTopBorder[p+2] - targetBorder[p+2];
-                int magnitude = sqrt(rDif * rDif + gDif * gDif + bDif * bDif);
-                error += magnitude;
-            }
+        const StripMatrix &blockStrips = stripMatrix((StripSide)side);
+        const StripMatrix &facingStrips = stripMatrix(facingSide((StripSide)side));
+        int length = blockStrips.length;
+        neighbourStrips.resize(positions.size() * length);
+        for (size_t i = 0; i < positions.size(); i++)
+            std::copy(facingStrips.strip(neighbours[i]), facingStrips.strip(neighbours[i]) + length, &neighbourStrips[i * length]);
+        products.resize(positions.size() * totalNumBlocks);
+        crossProducts(neighbourStrips.data(), (int)positions.size(), blockStrips.strip(0), totalNumBlocks, length, products.data());
+        
+        for (size_t i = 0; i < positions.size(); i++) {
+            long long neighbourNorm = facingStrips.norm(neighbours[i]);
+            long long *positionErrors = &errors[positions[i] * totalNumBlocks];
+            const GLint *positionProducts = &products[i * totalNumBlocks];
+            for (GLint j = 0; j < totalNumBlocks; j++)
+                positionErrors[j] += neighbourNorm + blockStrips.norm(j) - 2 * (long long)positionProducts[j];
         }
-    
-        errorBlock b;
-        b.error = error;
-        b.index = i;
-        possibleBlocks.push_back(b);
     }
     
-    // Sort blocks so we can choose from the lowest errors
-    auto sortErrorBlocks = [](errorBlock a, errorBlock b) { return a.error < b.error; };
-    std::sort(possibleBlocks.begin(), possibleBlocks.end(), sortErrorBlocks);
-    int chosenBlock = rand()%(blockChoosingRandomness);
-    
-    col = possibleBlocks[chosenBlock].index % numCols;
-    row = possibleBlocks[chosenBlock].index / numCols;
-    // Calculate minimum error border path for left border of chosen block
+    for (size_t p = 0; p < placements.size(); p++) {
+        const BlockPlacement &place = placements[p];
+        chosen[p] = chooseBlock(&errors[p * totalNumBlocks], totalNumBlocks);
+        getBorderPaths(chosen[p], place.sourceBlockLeft, place.sourceBlockBottom, place.type, place.borderPathLeft, place.borderPathBottom, targetImage, place.drawX, place.drawY);
+    }
+}
+
+// Find a low error block for one position with a PatchMatch step instead of scanning every block
+// Params: current - the block at this position from the last pass, or -1 if it has none yet
+//         the rest are as in findMinimumErrorBlock; for PatchMatch, sourceBlockRight and sourceBlockTop are simply
+//         the blocks to the right and above, if they have been chosen
+// Candidates are the current block, the blocks that continue each neighbour in the source image (propagation),
+// then random blocks at shrinking distances around the best of those (random search)
+// A position without a block chooses randomly from the best candidates like findMinimumErrorBlock does,
+// otherwise the best candidate is kept so the passes converge
+// Border paths are not calculated, since neighbours may still change
+GLint SourceImage::findPatchMatchBlock(GLint current, int sourceBlockLeft, int sourceBlockBottom, BlockMatch type, Image *targetImage, int drawX, int drawY, int sourceBlockRight, int sourceBlockTop) {
+    std::vector<GLint> candidates;
+    if (current >= 0)
+        candidates.push_back(current);
+    // The block to the right of the left neighbour in the source would continue it seamlessly, and so on
     if (type == Right || type == Both) {
-        image->readPixels(posX(col), posY(row), borderSize, blockSize, targetBorder);
-        if (targetImage != NULL) {
-            targetImage->readPixels(drawX, drawY, borderSize, blockSize, targetBlock);
-            getMinimumErrorPathWithTargetImage(targetBorder, sourceRightBorder, targetBlock, borderPathLeft, Right);
-        }
-        else
-            getMinimumErrorPath(targetBorder, sourceRightBorder, borderPathLeft, Right);
+        if (sourceBlockLeft % numCols + 1 < numCols)
+            candidates.push_back(sourceBlockLeft + 1);
     }
-    // Calculate minimum error border path for bottom border of chosen block
     if (type == Top || type == Both) {
-        image->readPixels(posX(col), posY(row), blockSize, borderSize, targetBorder);
-        if (targetImage != NULL) {
-            targetImage->readPixels(drawX, drawY, blockSize, borderSize, targetBlock);
-            getMinimumErrorPathWithTargetImage(targetBorder, sourceTopBorder, targetBlock, borderPathBottom, Top);
-        }
-        else
-            getMinimumErrorPath(targetBorder, sourceTopBorder, borderPathBottom, Top);
+        if (sourceBlockBottom / numCols + 1 < numRows)
+            candidates.push_back(sourceBlockBottom + numCols);
+    }
+    if (sourceBlockRight >= 0 && sourceBlockRight % numCols > 0)
+        candidates.push_back(sourceBlockRight - 1);
+    if (sourceBlockTop >= 0 && sourceBlockTop / numCols > 0)
+        candidates.push_back(sourceBlockTop - numCols);
+    // A new position starts from a few random blocks
+    if (current < 0) {
+        for (int i = 0; i < patchMatchRandomStarts; i++)
+            candidates.push_back(rand() % (numCols * numRows));
+    }
+    
+    ScanInput input;
+    TiledSource::Page pages[4];
+    prepareScan(input, pages, sourceBlockLeft, sourceBlockBottom, type, targetImage, drawX, drawY, sourceBlockRight, sourceBlockTop);
+    ScanKernel kernel = scanKernels[type][targetImage != NULL];
+    
+    // Score the candidates, dropping repeats
+    std::vector<std::pair<long long, GLint> > scored;
+    auto score = [&](std::vector<GLint> &blocks) {
+        std::sort(blocks.begin(), blocks.end());
+        blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+        std::vector<long long> errors(blocks.size());
+        input.candidates = blocks.data();
+        input.numBlocks = (GLint)blocks.size();
+        scan(kernel, input, errors.data());
+        for (size_t i = 0; i < blocks.size(); i++)
+            scored.push_back(std::make_pair(errors[i], blocks[i]));
+    };
+    score(candidates);
+    
+    // Random search around the best candidate so far, halving the distance every time
+    GLint best = std::min_element(scored.begin(), scored.end())->second;
+    std::vector<GLint> samples;
+    for (int radius = std::max(numCols, numRows); radius >= 1; radius /= 2) {
+        int col = best % numCols + rand() % (2 * radius + 1) - radius;
+        int row = best / numCols + rand() % (2 * radius + 1) - radius;
+        col = std::min(std::max(col, 0), numCols - 1);
+        row = std::min(std::max(row, 0), numRows - 1);
+        samples.push_back(row * numCols + col);
     }
+    score(samples);
+    releaseScan(input);
+    
+    std::sort(scored.begin(), scored.end());
+    scored.erase(std::unique(scored.begin(), scored.end()), scored.end());
+    if (current >= 0)
+        return scored[0].second;
+    int poolSize = blockChoosingRandomness < (int)scored.size() ? blockChoosingRandomness : (int)scored.size();
+    return scored[rand() % poolSize].second;
+}
+
+// Point input at the borders of the neighbouring blocks that candidates are compared against, where they are in the source,
+// and calculate the luminance of the target image under the block
+// pages holds the pages of a paged source that the borders are on until the scan is done
+// input.numBlocks and input.candidates are left for the caller to set, and releaseScan frees the luminance
+void SourceImage::prepareScan(ScanInput &input, TiledSource::Page *pages, int sourceBlockLeft, int sourceBlockBottom, BlockMatch type, Image *targetImage, int drawX, int drawY, int sourceBlockRight, int sourceBlockTop) {
+    GLint step = blockSize - borderSize;
+    int *targetLuminance = NULL;
     
+    input.leftBorder = input.bottomBorder = input.wrapLeftBorder = input.wrapBottomBorder = ImageView();
+    // Right border of source block begins where block to right starts
     if (type == Right || type == Both)
-        delete[] sourceRightBorder;
+        input.leftBorder = blockView(sourceBlockLeft, pages[0]).subView(step, 0, borderSize, blockSize);
+    // Top border of source block begins where block above starts
     if (type == Top || type == Both)
-        delete[] sourceTopBorder;
-    delete[] targetBorder;
+        input.bottomBorder = blockView(sourceBlockBottom, pages[1]).subView(0, step, blockSize, borderSize);
+    // Left border of the wrapped block starts where that block starts
+    if (sourceBlockRight >= 0)
+        input.wrapLeftBorder = blockView(sourceBlockRight, pages[2]).subView(0, 0, borderSize, blockSize);
+    // Bottom border of the wrapped block starts where that block starts
+    if (sourceBlockTop >= 0)
+        input.wrapBottomBorder = blockView(sourceBlockTop, pages[3]).subView(0, 0, blockSize, borderSize);
     
-    return possibleBlocks[chosenBlock].index;
+    // The target image block is the same for every candidate, so its luminance is only calculated once
+    // Blocks on the right and top edges hang off the target image, which counts as black there
+    if (targetImage != NULL) {
+        ImageView target = targetImage->view();
+        targetLuminance = new int[blockSize * blockSize];
+        for (int y = 0; y < blockSize; y++) {
+            for (int x = 0; x < blockSize; x++) {
+                GLubyte pixel[3];
+                target.readPixel(drawX + x, drawY + y, EdgeZero, pixel);
+                targetLuminance[y * blockSize + x] = pixelLuminance(pixel[0], pixel[1], pixel[2]);
+            }
+        }
+    }
+    
+    // Paged sources are scanned a page at a time, see scan
+    ImageView source = image != NULL ? image->view() : ImageView();
+    input.image = source.data;
+    input.rowLength = source.stride;
+    input.channelStride = source.channelStride;
+    input.numCols = numCols;
+    input.numBlocks = 0;
+    input.step = step;
+    input.blockSize = blockSize;
+    input.borderSize = borderSize;
+    input.targetLuminance = targetLuminance;
+    input.candidates = NULL;
+    input.firstBlock = 0;
 }
 
-// Find the minimum error path between the given borders (orientation given by type) and put in path param
-void SourceImage::getMinimumErrorPath(GLubyte *targetBorder, GLubyte *sourceBorder, GLint *path, BlockMatch type) {
+void SourceImage::releaseScan(ScanInput &input) {
+    delete[] input.targetLuminance;
+}
+
+// Run kernel over the blocks in input, or its candidates, putting their errors in errors
+// Paged sources are scanned one page at a time, so every block is read from the page that holds all of it
+void SourceImage::scan(ScanKernel kernel, ScanInput &input, long long *errors) {
+    if (tiles == NULL) {
+        runKernel(kernel, input, errors);
+        return;
+    }
     
-    // Create matrices for dynamic programming algorithm
-    int **errorMatrix = new int*[blockSize];     // error for each pixel
-    int **pathErrorMatrix = new int*[blockSize]; // best cumulative error of path up to this pixel
-    int **pathMatrix = new int*[blockSize];      // holds the best next column to move to from this pixel
-    for (int i = 0; i < blockSize; i++) {
-        errorMatrix[i] = new int[borderSize];
-        pathErrorMatrix[i] = new int[borderSize];
-        pathMatrix[i] = new int[borderSize];
+    // The pages already in memory are pinned there and scanned first, and the rest are read through the room left
+    // Scanning in a fixed order instead would have the least recently used page always be the next one needed,
+    // so a source larger than the cap would be read whole for every scan
+    std::vector<int> pinned = tiles->pinResident();
+    std::vector<bool> isPinned(tiles->numPages(), false);
+    std::vector<int> order(pinned);
+    for (size_t i = 0; i < pinned.size(); i++)
+        isPinned[pinned[i]] = true;
+    for (int p = 0; p < tiles->numPages(); p++) {
+        if (!isPinned[p])
+            order.push_back(p);
     }
     
-    // Get pixel differences and fill matrices with initial values
-    for (int i = 0; i < borderSize * blockSize * 3; i += 3) {
-        int rDif = targetBorder[i] - sourceBorder[i];
-        int gDif = targetBorder[i+1] - sourceBorder[i+1];
-        int bDif = targetBorder[i+2] - sourceBorder[i+2];
-        int magnitude = sqrt(rDif * rDif + gDif * gDif + bDif * bDif);
-        
-        int row, col;
-        // Borders are stored in raster order
-        // For left/right border, fill in matrices in raster order
-        if (type == Right) {
-            row = (i/3) / borderSize;
-            col = (i/3) % borderSize;
-        }
-        // For top/bottom border, we have to pretend matrix is rotated
-        // So the top row of the border maps to the right column of the matrix
-        else {
-            row = (i/3) % blockSize;
-            col = borderSize - ((i/3) / blockSize) - 1;
+    ScanInput pageInput = input;
+    std::vector<GLint> pageCandidates;
+    std::vector<long long> pageErrors;
+    for (size_t o = 0; o < order.size(); o++) {
+        int p = order[o];
+        GLint col0, row0, cols, rows;
+        tiles->pageBlocksOf(p, col0, row0, cols, rows);
+        // Block indices on the page count from its first block, with cols blocks per row
+        std::vector<int> positions;
+        pageCandidates.clear();
+        if (input.candidates != NULL) {
+            for (int i = 0; i < input.numBlocks; i++) {
+                GLint index = input.candidates[i];
+                if (tiles->pageOf(index) == p) {
+                    positions.push_back(i);
+                    pageCandidates.push_back((index / numCols - row0) * cols + index % numCols - col0);
+                }
+            }
+            if (positions.empty())
+                continue;
         }
-        errorMatrix[row][col] = magnitude;
         
-        // For the last row, path error is equal to the error of that pixel
-        // For other rows, set to -1 to know when it has not been set
-        if (row == blockSize - 1)
-            pathErrorMatrix[row][col] = magnitude;
-        else
-            pathErrorMatrix[row][col] = -1;
+        TiledSource::Page page = tiles->getPage(p);
+        pageInput.image = page->data();
+        pageInput.rowLength = tiles->pageWidth(cols) * 3;
+        pageInput.numCols = cols;
+        pageInput.candidates = input.candidates != NULL ? pageCandidates.data() : NULL;
+        pageInput.numBlocks = input.candidates != NULL ? (GLint)pageCandidates.size() : cols * rows;
+        pageErrors.resize(pageInput.numBlocks);
+        runKernel(kernel, pageInput, pageErrors.data());
+        
+        for (int i = 0; i < pageInput.numBlocks; i++) {
+            if (input.candidates != NULL)
+                errors[positions[i]] = pageErrors[i];
+            else
+                errors[(row0 + i / cols) * numCols + col0 + i % cols] = pageErrors[i];
+        }
+    }
+    tiles->unpin(pinned);
+}
+
+void SourceImage::setThreads(int threads, int chunkBlocks) {
+    scanThreads = threads > 1 ? threads : 1;
+    scanChunk = chunkBlocks > 1 ? chunkBlocks : 1;
+}
+
+// Run kernel over the blocks of input, in chunks of scanChunk blocks that scanThreads threads take in turn
+// Threads are started for each scan, so they only pay off when scans are long; see AutoTuner
+void SourceImage::runKernel(ScanKernel kernel, const ScanInput &input, long long *errors) {
+    int chunks = (input.numBlocks + scanChunk - 1) / scanChunk;
+    int threads = scanThreads < chunks ? scanThreads : chunks;
+    if (threads <= 1) {
+        kernel(input, errors);
+        return;
     }
     
-    // Calculate best path for each pixel in first row
-    int bestStartingPixel = 0;
-    int bestPathError = pixelError(0, 0, errorMatrix, pathErrorMatrix, pathMatrix);
-    for (int i = 1; i < borderSize; i++) {
-        int error = pixelError(0, i, errorMatrix, pathErrorMatrix, pathMatrix);
-        if (error < bestPathError) {
-            bestPathError = error;
-            bestStartingPixel = i;
+    std::atomic<int> nextBlock(0);
+    auto work = [&]() {
+        ScanInput chunk = input;
+        for (int b = nextBlock.fetch_add(scanChunk); b < input.numBlocks; b = nextBlock.fetch_add(scanChunk)) {
+            chunk.numBlocks = input.numBlocks - b < scanChunk ? input.numBlocks - b : scanChunk;
+            if (input.candidates != NULL)
+                chunk.candidates = input.candidates + b;
+            else
+                chunk.firstBlock = input.firstBlock + b;
+            kernel(chunk, errors + b);
         }
-    }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++)
+        workers.push_back(std::thread(work));
+    work();
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+// View of the pixels of block index, where they are in the source
+// For paged sources, page holds the page the block is on until the caller is done with it
+ImageView SourceImage::blockView(GLint index, TiledSource::Page &page) {
+    GLint col = index % numCols, row = index / numCols;
+    if (tiles == NULL)
+        return image->view().subView(posX(col), posY(row), blockSize, blockSize);
+    GLint col0, row0, cols, rows;
+    int p = tiles->pageOf(index);
+    tiles->pageBlocksOf(p, col0, row0, cols, rows);
+    page = tiles->getPage(p);
+    ImageView pageView(page->data(), tiles->pageWidth(cols), tiles->pageWidth(rows), tiles->pageWidth(cols) * 3);
+    return pageView.subView(posX(col - col0), posY(row - row0), blockSize, blockSize);
+}
+
+// Calculate the minimum error border paths of an already chosen block against its neighbors
+// Params: index - the block being placed
+//         sourceBlockLeft, sourceBlockBottom, type - the neighbors to match against, as in findMinimumErrorBlock
+// Fills borderPathLeft and/or borderPathBottom depending on type
+void SourceImage::getBorderPaths(GLint index, int sourceBlockLeft, int sourceBlockBottom, BlockMatch type, GLubyte *borderPathLeft, GLubyte *borderPathBottom, Image *targetImage, int drawX, int drawY) {
+    if (type == None)
+        return;
     
-    // Reconstruct best path and fill path array
-    int nextBestCol = bestStartingPixel;
-    path[0] = nextBestCol;
-    for (int i = 1; i < blockSize; i++) {
-        nextBestCol = pathMatrix[i-1][nextBestCol];
-        path[i] = nextBestCol;
-    }
+    GLint step = blockSize - borderSize;
+    TiledSource::Page blockPage, neighbourPage;
+    ImageView block = blockView(index, blockPage);
     
-    // Clean up memory
-    for (int i = 0; i < blockSize; i++) {
-        delete [] errorMatrix[i];
-        delete [] pathErrorMatrix[i];
-        delete [] pathMatrix[i];
+    // Calculate minimum error border path for left border of chosen block
+    if (type == Right || type == Both) {
+        ImageView sourceBorder = blockView(sourceBlockLeft, neighbourPage).subView(step, 0, borderSize, blockSize);
+        ImageView targetBorder = block.subView(0, 0, borderSize, blockSize);
+        if (targetImage != NULL)
+            getMinimumErrorPathWithTargetImage(targetBorder, sourceBorder, targetImage->view(), drawX, drawY, borderPathLeft, Right);
+        else
+            getMinimumErrorPath(targetBorder, sourceBorder, borderPathLeft, Right);
     }
+    // Calculate minimum error border path for bottom border of chosen block
+    if (type == Top || type == Both) {
+        ImageView sourceBorder = blockView(sourceBlockBottom, neighbourPage).subView(0, step, blockSize, borderSize);
+        ImageView targetBorder = block.subView(0, 0, blockSize, borderSize);
+        if (targetImage != NULL)
+            getMinimumErrorPathWithTargetImage(targetBorder, sourceBorder, targetImage->view(), drawX, drawY, borderPathBottom, Top);
+        else
+            getMinimumErrorPath(targetBorder, sourceBorder, borderPathBottom, Top);
+    }
+}
+
+// Find the minimum error path between the given borders (orientation given by type) and put in path param
+void SourceImage::getMinimumErrorPath(const ImageView &targetBorder, const ImageView &sourceBorder, GLubyte *path, BlockMatch type) {
+    
+    // Error for each pixel, the path goes down the rows of this matrix
+    // For top/bottom borders the matrix is rotated, see SeamErrorKernel
+    int *errorMatrix = new int[blockSize * borderSize];
+    seamErrorKernels[type == Right ? 0 : 1](targetBorder, sourceBorder, blockSize, borderSize, errorMatrix);
+    cutKernel(errorMatrix, blockSize, borderSize, path);
+    
     delete[] errorMatrix;
-    delete[] pathErrorMatrix;
-    delete[] pathMatrix;
 }
 
 // Get minimum error path between two borders, taking error with target image into consideration
-void SourceImage::getMinimumErrorPathWithTargetImage(GLubyte *sourceBorder1, GLubyte *sourceBorder2, GLubyte *targetImageBorder, GLint *path, BlockMatch type) {
+// The border covers the target image from targetX, targetY, which counts as black past its edges
+void SourceImage::getMinimumErrorPathWithTargetImage(const ImageView &sourceBorder1, const ImageView &sourceBorder2, const ImageView &targetImage, int targetX, int targetY, GLubyte *path, BlockMatch type) {
     
     // Create matrices for dynamic programming algorithm
-    int **errorMatrix = new int*[blockSize];     // error for each pixel
-    int **errorMatrixLeft = new int*[blockSize];    // error for each pixel between sourceBorder2 and targetImageBorder (left side of the border of the left block, right border of that block)
-    int **errorMatrixRight = new int*[blockSize];    // error for each pixel between sourceBorder1 and targetImageBorder (right side of the border of the right block, left border of that block)
-    int **pathErrorMatrix = new int*[blockSize]; // best cumulative error of path up to this pixel
-    int **pathMatrix = new int*[blockSize];      // holds the best next column to move to from this pixel
-    for (int i = 0; i < blockSize; i++) {
-        errorMatrix[i] = new int[borderSize];
-        errorMatrixLeft[i] = new int[borderSize];
-        errorMatrixRight[i] = new int[borderSize];
-        pathErrorMatrix[i] = new int[borderSize];
-        pathMatrix[i] = new int[borderSize];
-    }
+    int *errorMatrix = new int[blockSize * borderSize];      // error for each pixel
+    int *errorMatrixLeft = new int[blockSize * borderSize];  // error for each pixel between sourceBorder2 and targetImageBorder (left side of the border of the left block, right border of that block)
+    int *errorMatrixRight = new int[blockSize * borderSize]; // error for each pixel between sourceBorder1 and targetImageBorder (right side of the border of the right block, left border of that block)
     
     // Construct error matrix
     // Algo: the error of a pixel is (the sum of the errors with the left border up to that pixel from the left) plus (the sum of the errors with right border up to that pixel from the right)
     // So with the left border, pixel error is error sum up to that pixel from the left
     // And with the right border, pixel error is error sum up to and including that pixel from the right
     
-    // First, get initial pixel errors with target image and store in errorMatrixLeft and errorMatrixRight
+    // Initially fill errorMatrix with errors between two blocks being drawn
+    seamErrorKernels[type == Right ? 0 : 1](sourceBorder1, sourceBorder2, blockSize, borderSize, errorMatrix);
+    
+    // Then get pixel errors with target image and store in errorMatrixLeft and errorMatrixRight
     for (int i = 0; i < borderSize * blockSize * 3; i += 3) {
+        int x = (i/3) % sourceBorder1.width, y = (i/3) / sourceBorder1.width;
+        GLubyte targetPixel[3], sourcePixel1[3], sourcePixel2[3];
+        targetImage.readPixel(targetX + x, targetY + y, EdgeZero, targetPixel);
+        sourceBorder1.readPixel(x, y, EdgeZero, sourcePixel1);
+        sourceBorder2.readPixel(x, y, EdgeZero, sourcePixel2);
         int row, col;
         // Borders are stored in raster order
         // For left/right border, fill in matrices in raster order
@@ -296,37 +608,33 @@ void SourceImage::getMinimumErrorPathWithTargetImage(GLubyte *sourceBorder1, GLu
             row = (i/3) % blockSize;
             col = borderSize - ((i/3) / blockSize) - 1;
         }
+        int index = row * borderSize + col;
         
         // We are comparing luminance values
-        int targetLuminance = pixelLuminance(targetImageBorder[i], targetImageBorder[i+1], targetImageBorder[i+2]);
-        int sourceLuminance = pixelLuminance(sourceBorder1[i], sourceBorder1[i+1], sourceBorder1[i+2]);
+        int targetLuminance = pixelLuminance(targetPixel[0], targetPixel[1], targetPixel[2]);
+        int sourceLuminance = pixelLuminance(sourcePixel1[0], sourcePixel1[1], sourcePixel1[2]);
         
-        errorMatrixRight[row][col] = abs(targetLuminance - sourceLuminance);
+        errorMatrixRight[index] = abs(targetLuminance - sourceLuminance);
         
-        sourceLuminance = pixelLuminance(sourceBorder2[i], sourceBorder2[i+1], sourceBorder2[i+2]);
+        sourceLuminance = pixelLuminance(sourcePixel2[0], sourcePixel2[1], sourcePixel2[2]);
         
-        errorMatrixLeft[row][col] = abs(targetLuminance - sourceLuminance);
-        
-        // Also, initially fill errorMatrix with errors between two blocks being drawn
-        int rDif = sourceBorder1[i] - sourceBorder2[i];
-        int gDif = sourceBorder1[i+1] - sourceBorder2[i+1];
-        int bDif = sourceBorder1[i+2] - sourceBorder2[i+2];
-        int magnitude = sqrt(rDif * rDif + gDif * gDif + bDif * bDif);
-        
-        errorMatrix[row][col] = magnitude;
+        errorMatrixLeft[index] = abs(targetLuminance - sourceLuminance);
     }
     // Then find row errors and construct errorMatrix
     for (int r = 0; r < blockSize; r++) {
+        int *rowError = errorMatrix + r * borderSize;
+        int *rowLeft = errorMatrixLeft + r * borderSize;
+        int *rowRight = errorMatrixRight + r * borderSize;
         int leftError = 0, rightError = 0;
         // Replace values of errorMatrixLeft with values summed up to c from left
         for (int c = 0; c < borderSize; c++) {
-            leftError += errorMatrixLeft[r][c];
-            errorMatrixLeft[r][c] = leftError;
+            leftError += rowLeft[c];
+            rowLeft[c] = leftError;
         }
         // Replace values of errorMatrixRight with values summed up to c from right
         for (int c = borderSize - 1; c >= 0; c--) {
-            rightError += errorMatrixRight[r][c];
-            errorMatrixRight[r][c] = rightError;
+            rightError += rowRight[c];
+            rowRight[c] = rightError;
         }
         // Fill errorMatrix
         for (int c = 0; c < borderSize; c++) {
@@ -335,154 +643,107 @@ void SourceImage::getMinimumErrorPathWithTargetImage(GLubyte *sourceBorder1, GLu
             // and at c == borderSize-1, pixel error = sum of errors in that row between target border and left block border
             // Note: we are also adding in the pixel error between the two blocks being drawn
             if (c == 0)
-                errorMatrix[r][c] += errorMatrixRight[r][c];
-            else
-                errorMatrix[r][c] += errorMatrixRight[r][c] + errorMatrixLeft[r][c-1];
-            
-            // For the last row, path error is equal to the error of that pixel
-            // For other rows, set to -1 to know when it has not been set
-            if (r == blockSize - 1)
-                pathErrorMatrix[r][c] = errorMatrix[r][c];
+                rowError[c] += rowRight[c];
             else
-                pathErrorMatrix[r][c] = -1;
+                rowError[c] += rowRight[c] + rowLeft[c-1];
         }
     }
     
-    // Calculate best path for each pixel in first row
-    int bestStartingPixel = 0;
-    int bestPathError = pixelError(0, 0, errorMatrix, pathErrorMatrix, pathMatrix);
-    for (int i = 1; i < borderSize; i++) {
-        int error = pixelError(0, i, errorMatrix, pathErrorMatrix, pathMatrix);
-        if (error < bestPathError) {
-            bestPathError = error;
-            bestStartingPixel = i;
-        }
-    }
+    cutKernel(errorMatrix, blockSize, borderSize, path);
     
-    // Reconstruct best path and fill path array
-    int nextBestCol = bestStartingPixel;
-    path[0] = nextBestCol;
-    for (int i = 1; i < blockSize; i++) {
-        nextBestCol = pathMatrix[i-1][nextBestCol];
-        path[i] = nextBestCol;
-    }
-    
-    // Clean up memory
-    for (int i = 0; i < blockSize; i++) {
-        delete [] errorMatrix[i];
-        delete [] errorMatrixLeft[i];
-        delete [] errorMatrixRight[i];
-        delete [] pathErrorMatrix[i];
-        delete [] pathMatrix[i];
-    }
     delete[] errorMatrix;
     delete[] errorMatrixLeft;
     delete[] errorMatrixRight;
-    delete[] pathErrorMatrix;
-    delete[] pathMatrix;
 }
 
-// Helper method for dynamic programming path generation
-int SourceImage::pixelError(int r, int c, int **errorMatrix, int **pathErrorMatrix, int **pathMatrix) {
-    // Derived from paper... E[r,c] = e[r,c] + min(E[r+1,c-1], E[r+1,c], E[r+1,c+1])
-    
-    // Calculate value of path at this pixel if it hasn't been calculated yet
-    if (pathErrorMatrix[r][c] < 0) {
-        int min, cL = -1, cC = -1, cR = -1;
-        
-        // Find best path with dynamic programming, don't go beyond bounds of border
-        if (c == 0) {
-            cC = pixelError(r+1, c, errorMatrix, pathErrorMatrix, pathMatrix);
-            cR = pixelError(r+1, c+1, errorMatrix, pathErrorMatrix, pathMatrix);
-            min = min2(cC, cR);
-        }
-        else if (c == borderSize - 1) {
-            cL = pixelError(r+1, c-1, errorMatrix, pathErrorMatrix, pathMatrix);
-            cC = pixelError(r+1, c, errorMatrix, pathErrorMatrix, pathMatrix);
-            min = min2(cL, cC);
-        }
-        else {
-            cL = pixelError(r+1, c-1, errorMatrix, pathErrorMatrix, pathMatrix);
-            cC = pixelError(r+1, c, errorMatrix, pathErrorMatrix, pathMatrix);
-            cR = pixelError(r+1, c+1, errorMatrix, pathErrorMatrix, pathMatrix);
-            min = min3(cL, cC, cR);
-        }
-        
-        // Set pathMatrix value; go left, center or right depending on best path
-        if (min == cL)
-            pathMatrix[r][c] = c - 1;
-        else if (min == cC)
-            pathMatrix[r][c] = c;
-        else if (min == cR)
-            pathMatrix[r][c] = c + 1;
-        
-        // Set pathErrorMatrix value, sum of error at this pixel and best path error up to this pixel
-        pathErrorMatrix[r][c] = errorMatrix[r][c] + min;
-    }
-    return pathErrorMatrix[r][c];
-}
-
-// Get min of two ints
-int SourceImage::min2(int a, int b) {
-    if (a < b)
-        return a;
-    return b;
+// Get the luminance value from RGB set
+int SourceImage::pixelLuminance(int r, int g, int b) {
+    return luminance(r, g, b);
 }
 
-// Get min of three ints
-int SourceImage::min3(int a, int b, int c) {
-    if (a < b)
-        b = a;
-    if (b < c)
-        return b;
-    return c;
+void SourceImage::drawFullImage() {
+    if (image != NULL)
+        image->drawFullImage();
 }
 
-// Get the luminance value from RGB set
-int SourceImage::pixelLuminance(int r, int g, int b) {
-    // R G and B are weighed differently because of human eye color sensitivity
-    return 0.299 * r + 0.587 * g + 0.114 * b;
+bool SourceImage::pageReadFailed() {
+    return tiles != NULL && tiles->pageReadFailed();
 }
 
-void SourceImage::drawFullImage() {
-    image->drawFullImage();
+void SourceImage::printMemoryReport() {
+    if (tiles != NULL)
+        tiles->printReport();
 }
 
-// Draw the block at index at x,y on the screen
-void SourceImage::drawBlock(int index, int drawX, int drawY, int *borderPathLeft, int *borderPathBottom) {
-    // Get x and y of block on the source image
-    int srcBlockX = posX(index % numCols);
-    int srcBlockY = posY(index / numCols);
-    
-    // Array that will store row of pixels to be drawn at a time
-    GLubyte *blockRow = new GLubyte[blockSize * 3];
-    
-    glDrawBuffer(GL_FRONT);
-    // Draw each row of pixels for this block individually
-    // For each block, we account for the left and bottom borders, and draw the right and top flat
+// Composite the block at index at x,y into target, only writing pixels inside the clip rectangle [clipX0, clipX1) x [clipY0, clipY1)
+// Blocks must be composited in placement order, since each block overwrites the right and top borders of the ones before it
+// For tileable textures, wrap makes the block wrap around the edges of target, and clipPathRight/clipPathTop are the
+// left/bottom border paths of the blocks it wraps onto (NULL for none), which own the pixels past those paths
+void SourceImage::compositeBlock(GLint index, GLint drawX, GLint drawY, GLubyte *borderPathLeft, GLubyte *borderPathBottom, GLubyte *clipPathRight, GLubyte *clipPathTop, Image *target, GLint clipX0, GLint clipY0, GLint clipX1, GLint clipY1, bool wrap) {
+    // Get the block's pixels on the source image, they are written straight from there
+    // unless they are in another layout than packed RGB, then each row is packed first
+    TiledSource::Page page;
+    ImageView block = blockView(index, page);
+    const GLubyte *blockRow = NULL;
+    std::vector<GLubyte> packedRow(block.isPacked() ? 0 : blockSize * 3);
+    int step = blockSize - borderSize;
+    
+    // Write pixels [x0, x1) of blockRow to row ty of target, splitting the span where it wraps around
+    auto writeSpan = [&](int x0, int x1, int ty) {
+        int tx = drawX + x0;
+        if (wrap)
+            tx %= target->width;
+        while (x0 < x1) {
+            int spanEnd = x1;
+            if (wrap && tx + (x1 - x0) > target->width)
+                spanEnd = x0 + target->width - tx;
+            int cx0 = tx < clipX0 ? clipX0 : tx;
+            int cx1 = tx + spanEnd - x0 > clipX1 ? clipX1 : tx + spanEnd - x0;
+            if (cx0 < cx1)
+                target->writePixels(cx0, ty, cx1 - cx0, 1, blockRow + (cx0 - tx + x0) * 3);
+            x0 = spanEnd;
+            tx = 0;
+        }
+    };
+    
+    // Write each row of pixels for this block individually
+    // For each block, we account for the left and bottom borders, and write the right and top flat
     for (int y = 0; y < blockSize; y++) {
-        // Read where the border path indicates for this pixel row
-        int xRead = srcBlockX + borderPathLeft[y];
-        int yRead = srcBlockY + y;
+        int ty = drawY + y;
+        if (wrap)
+            ty %= target->height;
+        if (ty < clipY0 || ty >= clipY1)
+            continue;
         
-        // For bottom border section, draw pixels one at a time
-        if (y < borderSize) {
-            for (int x = borderPathLeft[y]; x < blockSize; x++) {
-                // Draw this pixel if the border path is at or below this row at this column
-                if (borderPathBottom[x] <= y) {
-                    image->readPixels(srcBlockX + x, yRead, 1, 1, blockRow);
-                    glRasterPos2i(drawX + x, drawY + y);
-                    glDrawPixels(1, 1, GL_RGB, GL_UNSIGNED_BYTE, blockRow);
-                }
+        // Only write the part of this row that is right of the left border path and left of the wrapped block's path
+        int xStart = borderPathLeft[y], xEnd = blockSize;
+        if (clipPathRight != NULL)
+            xEnd = step + clipPathRight[y];
+        if (xStart >= xEnd)
+            continue;
+        
+        blockRow = block.row(y);
+        if (!block.isPacked()) {
+            for (int x = 0; x < blockSize; x++)
+                block.readPixel(x, y, EdgeZero, &packedRow[x * 3]);
+            blockRow = packedRow.data();
+        }
+        
+        // For bottom border and wrapped top border sections, write pixels one at a time
+        if (y < borderSize || (clipPathTop != NULL && y >= step)) {
+            for (int x = xStart; x < xEnd; x++) {
+                // Write this pixel if the border path is at or below this row at this column
+                // and the wrapped block's border path is above it
+                if (y < borderSize && borderPathBottom[x] > y)
+                    continue;
+                if (clipPathTop != NULL && y >= step && y - step >= clipPathTop[x])
+                    continue;
+                writeSpan(x, x + 1, ty);
             }
         }
-        // For rest of block, just draw full row starting at left border
+        // For rest of block, just write full row starting at left border
         else {
-            image->readPixels(xRead, yRead, blockSize - borderPathLeft[y], 1, blockRow);
-            glRasterPos2i(drawX + borderPathLeft[y], drawY + y);
-            glDrawPixels(blockSize - borderPathLeft[y], 1, GL_RGB, GL_UNSIGNED_BYTE, blockRow);
+            writeSpan(xStart, xEnd, ty);
         }
     }
-    
-    delete[] blockRow;
-}
\ No newline at end of file
+}
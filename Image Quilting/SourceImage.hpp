@@ -10,7 +10,13 @@
 #define SourceImage_hpp
 
 #include <stdio.h>
+#include <vector>
+#include <string>
+#include <mutex>
 #include "Image.hpp"
+#include "ErrorKernels.hpp"
+#include "BatchedErrors.hpp"
+#include "TiledSource.hpp"
 
 #ifdef __APPLE__
 #include <GLUT/glut.h>
@@ -18,39 +24,96 @@
 #include <GL/glut.h>
 #endif
 
-enum BlockMatch {
-    Right,
-    Top,
-    Both,
-    None
+// How the block for each position of a texture is searched for
+enum SearchStrategy {
+    ExhaustiveSearch,   // compare every block of the source image
+    PatchMatchSearch    // improve a guess per position with propagation and random search, over a few passes
+};
+
+// A block position to find a block for and the neighbours it is matched against, as given to findMinimumErrorBlock
+struct BlockPlacement {
+    int sourceBlockLeft, sourceBlockBottom;
+    BlockMatch type;
+    GLubyte *borderPathLeft, *borderPathBottom;
+    int drawX, drawY;
+    int sourceBlockRight, sourceBlockTop;
 };
 
 class SourceImage {
 private:
+    // The source is either all in memory or read a page at a time, the other one is NULL
     Image *image;
+    TiledSource *tiles;
+    GLsizei width, height;
+    // How the source's pixels are held, packed RGB for paged sources
+    PixelLayout pixelLayout;
     GLint numCols, numRows;
     GLint blockChoosingRandomness;
+    ErrorMetric errorMetric;
+    std::string error;
+    // scan kernel for each kind of matching, without and with a target image
+    ScanKernel scanKernels[4][2];
+    // seam error kernel for Right and Top borders, and the cut through them
+    SeamErrorKernel seamErrorKernels[2];
+    CutKernel cutKernel;
+    // Whether findMinimumErrorBlocks may evaluate errors as matrix products, and the strip of each side
+    // of every block for it, built the first time they are needed
+    bool batched;
+    StripMatrix *strips[4];
+    std::mutex stripMutex;
+    const StripMatrix &stripMatrix(StripSide side);
+    int chooseBlock(const long long *errors, int count);
     GLint posX(GLint col);
     GLint posY(GLint row);
+    void prepareScan(ScanInput &input, TiledSource::Page *pages, int sourceBlockLeft, int sourceBlockBottom, BlockMatch type, Image *targetImage, int drawX, int drawY, int sourceBlockRight, int sourceBlockTop);
+    void releaseScan(ScanInput &input);
+    void scan(ScanKernel kernel, ScanInput &input, long long *errors);
+    // Threads a scan is split over and how many blocks each of them takes at a time
+    int scanThreads, scanChunk;
+    void runKernel(ScanKernel kernel, const ScanInput &input, long long *errors);
+    ImageView blockView(GLint index, TiledSource::Page &page);
 public:
     SourceImage();
-    SourceImage(const char *filename, GLint blockSize, GLint borderSize, GLint randomness);
+    // A memoryCap in bytes reads the source a page at a time, keeping at most that much of it in memory
+    // Otherwise the source is held in layout, see PixelLayout
+    SourceImage(const char *filename, GLint blockSize, GLint borderSize, GLint randomness, size_t memoryCap = 0, PixelLayout layout = PackedRGB);
     ~SourceImage();
     GLsizei blockSize, borderSize;
+    void setErrorMetric(ErrorMetric metric);
     // returns a completely random block index
     GLint getRandomBlock();
-    GLint findMinimumErrorBlock(int sourceBlock1, int sourceBlock2, BlockMatch type, int *borderPathLeft, int *borderPathBottom, Image *targetImage, int drawX, int drawY);
-    void getMinimumErrorPath(GLubyte *targetBorder, GLubyte *sourceBorder, GLint *path, BlockMatch type);
-    void getMinimumErrorPathWithTargetImage(GLubyte *targetBorder, GLubyte *sourceBorder, GLubyte *targetImageBorder, GLint *path, BlockMatch type);
-    int pixelError(int r, int c, int **errorMatrix, int **pathErrorMatrix, int **pathMatrix);
-    int min2(int a, int b);
-    int min3(int a, int b, int c);
+    GLint findMinimumErrorBlock(int sourceBlock1, int sourceBlock2, BlockMatch type, GLubyte *borderPathLeft, GLubyte *borderPathBottom, Image *targetImage, int drawX, int drawY, int sourceBlockRight = -1, int sourceBlockTop = -1);
+    // Find blocks for positions that don't depend on each other, like findMinimumErrorBlock does for each of them,
+    // putting the chosen blocks in chosen; with the squared metric and no target image their errors are found at once
+    void findMinimumErrorBlocks(const std::vector<BlockPlacement> &placements, Image *targetImage, GLint *chosen);
+    bool batchesErrors(Image *targetImage);
+    // Find a block for place like findMinimumErrorBlock, but only compare samples random blocks, or all of them
+    // if samples is at least the number of blocks; 0 compares one random block and leaves the border paths at 0
+    // Sets error to the error of the chosen block
+    GLint findSampledBlock(int samples, const BlockPlacement &place, Image *targetImage, long long &error);
+    GLint getNumBlocks() { return numCols * numRows; }
+    ErrorMetric getErrorMetric() { return errorMetric; }
+    PixelLayout getPixelLayout() { return pixelLayout; }
+    // Turn the matrix form of findMinimumErrorBlocks on or off, it is on by default
+    void setBatched(bool b) { batched = b; }
+    // Split every scan over threads threads, each taking chunkBlocks blocks at a time; 1 thread by default
+    void setThreads(int threads, int chunkBlocks);
+    GLint findPatchMatchBlock(GLint current, int sourceBlockLeft, int sourceBlockBottom, BlockMatch type, Image *targetImage, int drawX, int drawY, int sourceBlockRight, int sourceBlockTop);
+    void getBorderPaths(GLint index, int sourceBlock1, int sourceBlock2, BlockMatch type, GLubyte *borderPathLeft, GLubyte *borderPathBottom, Image *targetImage, int drawX, int drawY);
+    void getMinimumErrorPath(const ImageView &targetBorder, const ImageView &sourceBorder, GLubyte *path, BlockMatch type);
+    void getMinimumErrorPathWithTargetImage(const ImageView &targetBorder, const ImageView &sourceBorder, const ImageView &targetImage, int targetX, int targetY, GLubyte *path, BlockMatch type);
     int pixelLuminance(int r, int g, int b);
-    // draws the block at the given index at x,y on the screen
-    void drawBlock(GLint index, GLint drawX, GLint drawY, int *borderPathLeft, int *borderPathBottom);
+    // writes the block at the given index at x,y into target, clipped to the given rectangle
+    void compositeBlock(GLint index, GLint drawX, GLint drawY, GLubyte *borderPathLeft, GLubyte *borderPathBottom, GLubyte *clipPathRight, GLubyte *clipPathTop, Image *target, GLint clipX0, GLint clipY0, GLint clipX1, GLint clipY1, bool wrap);
     void drawFullImage();
-    GLint getWidth() { return image->width; }
-    GLint getHeight() { return image->height; }
+    // Print how much memory a paged source used
+    void printMemoryReport();
+    // Why the source couldn't be read, empty if it was; sources that couldn't be read have no blocks
+    const std::string &getError() const { return error; }
+    // Whether a page of a paged source couldn't be read after it was opened, which leaves blocks black
+    bool pageReadFailed();
+    GLint getWidth() { return width; }
+    GLint getHeight() { return height; }
 };
 
 #endif /* SourceImage_hpp */
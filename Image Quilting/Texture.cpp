@@ -8,20 +8,51 @@
 
 #include "Texture.hpp"
 #include <iostream>
+#include <chrono>
+
+// Passes over the whole texture a PatchMatch search makes, alternating direction
+static const int patchMatchIterations = 4;
+
+// Blocks the first block compares under a deadline, to measure how long comparing a block takes
+static const int calibrationSamples = 64;
 
 // Constructor for texture for synthesis
-Texture::Texture(SourceImage *sImage, int w, int h) {
+// If tile is set, the texture wraps around its edges so it can be repeated seamlessly
+Texture::Texture(SourceImage *sImage, int w, int h, bool tile) {
     sourceImage = sImage;
     targetImage = NULL;
+    tileable = tile;
+    search = ExhaustiveSearch;
+    deadline = 0;
+    cancelled = false;
+    writer = NULL;
     
-    // Select enough cols and rows to fill out width and height, and add one to each for the ends
-    cols = 1 + w / (sourceImage->blockSize - sourceImage->borderSize);
-    rows = 1 + h / (sourceImage->blockSize - sourceImage->borderSize);
+    int step = sourceImage->blockSize - sourceImage->borderSize;
+    if (tileable) {
+        // The last col and row overlap the first ones, so the texture must be a whole number of blocks
+        // and wide enough that a block doesn't wrap onto itself
+        cols = (w + step - 1) / step;
+        rows = (h + step - 1) / step;
+        int minBlocks = (sourceImage->blockSize + step - 1) / step;
+        if (minBlocks < 2)
+            minBlocks = 2;
+        if (cols < minBlocks) cols = minBlocks;
+        if (rows < minBlocks) rows = minBlocks;
+        w = cols * step;
+        h = rows * step;
+        std::cout << "Tileable texture: size rounded to " << w << "x" << h << "\n";
+    }
+    else {
+        // Select enough cols and rows to fill out width and height, and add one to each for the ends
+        cols = 1 + w / step;
+        rows = 1 + h / step;
+    }
     
     std::cout << "Texture: numCols:"<<cols<<" numRows:"<<rows<<"\n";
     
     width = w;
     height = h;
+    outputImage = new Image(width, height);
 }
 
 // Constructor for redrawing an image with a texture
@@ -29,6 +60,11 @@ Texture::Texture(SourceImage *sImage, int w, int h) {
 Texture::Texture(SourceImage *sImage, Image *tImage) {
     sourceImage = sImage;
     targetImage = tImage;
+    tileable = false;
+    search = ExhaustiveSearch;
+    deadline = 0;
+    cancelled = false;
+    writer = NULL;
     
     // Select enough cols and rows to fill out width and height, and add one to each for the ends
     cols = 1 + tImage->width / (sourceImage->blockSize - sourceImage->borderSize);
@@ -38,14 +74,11 @@ Texture::Texture(SourceImage *sImage, Image *tImage) {
     
     width = tImage->width;
     height = tImage->height;
+    outputImage = new Image(width, height);
 }
 
 Texture::~Texture() {
-    for (int i = 0; i < blocks.size(); i++) {
-        delete [] blocks[i]->borderPathLeft;
-        delete [] blocks[i]->borderPathBottom;
-        delete blocks[i];
-    }
+    delete outputImage;
 }
 
 int Texture::getWidth() {
@@ -56,67 +89,504 @@ int Texture::getHeight() {
     return height;
 }
 
-// Function to generate the data for this texture
-void Texture::generateTexture() {
-    int lastPercentage = 0, newPercentage = 0;
-    int blockIndex = 0; // The index in the source image of the next block to place in the texture
-    // Find an appropriate block and border path for every index in the texture
+// The neighbours to match the block at row r, col c against, zeroing the border paths it doesn't have
+// The blocks to the left and below must already have been placed
+BlockPlacement Texture::placement(int r, int c) {
+    BlockPlacement place;
+    place.drawX = layout.posX(c);
+    place.drawY = layout.posY(r);
+    place.borderPathLeft = layout.borderPathLeft(r, c);
+    place.borderPathBottom = layout.borderPathBottom(r, c);
+    // For tileable textures, the last col and row wrap around onto the first col and row
+    place.sourceBlockRight = tileable && c == cols - 1 ? layout.sourceIndex(r, 0) : -1;
+    place.sourceBlockTop = tileable && r == rows - 1 ? layout.sourceIndex(0, c) : -1;
+    place.sourceBlockLeft = c > 0 ? layout.sourceIndex(r, c-1) : 0;
+    place.sourceBlockBottom = r > 0 ? layout.sourceIndex(r-1, c) : 0;
+    
+    // The first block has nothing to match, except the target image
+    if (r == 0 && c == 0) {
+        place.type = BlockMatch::None;
+        for (int i = 0; i < sourceImage->blockSize; i++) {
+            place.borderPathLeft[i] = 0;
+            place.borderPathBottom[i] = 0;
+        }
+        place.borderPathLeft = place.borderPathBottom = NULL;
+    }
+    // For first row, only compare blocks horizontally
+    else if (r == 0) {
+        place.type = BlockMatch::Right;
+        for (int i = 0; i < sourceImage->blockSize; i++)
+            place.borderPathBottom[i] = 0;
+        place.borderPathBottom = NULL;
+    }
+    // For first col (along left edge) only compare blocks vertically
+    else if (c == 0) {
+        place.type = BlockMatch::Top;
+        for (int i = 0; i < sourceImage->blockSize; i++)
+            place.borderPathLeft[i] = 0;
+        place.borderPathLeft = NULL;
+    }
+    // For every other block, compare block to left and block below of new block
+    else
+        place.type = BlockMatch::Both;
+    return place;
+}
+
+// Choose the source block and border paths for the block at row r, col c
+// The blocks to the left and below must already have been placed
+void Texture::placeBlock(int r, int c) {
+    if (search == PatchMatchSearch) {
+        layout.sourceIndex(r, c) = -1;
+        improveBlock(r, c);
+        placeBorderPaths(r, c);
+        return;
+    }
+    
+    int blockIndex;
+    
+    // Choose first block (lower left corner)
+    if (c == 0 && r == 0) {
+        GLubyte *borderPathLeft = layout.borderPathLeft(r, c);
+        GLubyte *borderPathBottom = layout.borderPathBottom(r, c);
+        if (targetImage != NULL)
+            blockIndex = sourceImage->findMinimumErrorBlock(0, 0, None, NULL, NULL, targetImage, 0, 0);
+        else
+            blockIndex = sourceImage->getRandomBlock();
+        // Zero out border paths
+        for (int i = 0; i < sourceImage->blockSize; i++) {
+            borderPathLeft[i] = 0;
+            borderPathBottom[i] = 0;
+        }
+    }
+    else {
+        BlockPlacement place = placement(r, c);
+        blockIndex = sourceImage->findMinimumErrorBlock(place.sourceBlockLeft, place.sourceBlockBottom, place.type, place.borderPathLeft, place.borderPathBottom, targetImage, place.drawX, place.drawY, place.sourceBlockRight, place.sourceBlockTop);
+    }
+    
+    layout.sourceIndex(r, c) = blockIndex;
+}
+
+// Milliseconds since generateTexture started
+double Texture::elapsedMs() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+// How many blocks to compare for the next block, so the texture is finished by the deadline
+// The time left is shared evenly by the blocks left, at the cost per block measured so far
+// Once the deadline has passed, the rest of the blocks are placed at random without border paths
+int Texture::chooseSamples(int placed) {
+    GLint numBlocks = sourceImage->getNumBlocks();
+    double left = deadline - elapsedMs();
+    if (left <= 0)
+        return 0;
+    if (blockCost <= 0)
+        return numBlocks < calibrationSamples ? numBlocks : calibrationSamples;
+    double samples = left / (rows * cols - placed) / blockCost;
+    if (samples >= numBlocks)
+        return numBlocks;
+    return samples < 1 ? 1 : (int)samples;
+}
+
+// Choose the block at row r, col c by comparing samples source blocks, see SourceImage::findSampledBlock,
+// and keep track of how long that took and how well it matched
+void Texture::placeSampledBlock(int r, int c, int samples) {
+    double start = elapsedMs();
+    GLint numBlocks = sourceImage->getNumBlocks();
+    BlockPlacement place = placement(r, c);
+    
+    // The first block of a synthesized texture is random anyway
+    if (place.type == None && targetImage == NULL) {
+        layout.sourceIndex(r, c) = sourceImage->getRandomBlock();
+        return;
+    }
+    long long error;
+    layout.sourceIndex(r, c) = sourceImage->findSampledBlock(samples, place, targetImage, error);
+    
+    int compared = samples < 1 ? 1 : (samples < numBlocks ? samples : numBlocks);
+    double cost = (elapsedMs() - start) / compared;
+    blockCost = blockCost <= 0 ? cost : 0.8 * blockCost + 0.2 * cost;
+    
+    // Pixels the error was measured over: the overlaps with each neighbour and the target image under the block
+    long long pixels = 0;
+    int strip = sourceImage->blockSize * sourceImage->borderSize;
+    if (place.type == Right || place.type == Both)
+        pixels += strip;
+    if (place.type == Top || place.type == Both)
+        pixels += strip;
+    if (place.sourceBlockRight >= 0)
+        pixels += strip;
+    if (place.sourceBlockTop >= 0)
+        pixels += strip;
+    if (targetImage != NULL)
+        pixels += sourceImage->blockSize * sourceImage->blockSize;
+    errorSum += error;
+    matchedPixels += pixels;
+    sampledBlocks++;
+    effort.searchedFraction += (double)compared / numBlocks;
+    if (samples >= numBlocks)
+        effort.fullSearches++;
+    if (samples == 0)
+        effort.unseamed++;
+}
+
+// Place every block an anti-diagonal at a time, finding the blocks of a whole diagonal at once
+// The blocks to the left of and below a position are on the diagonal before it, so the positions
+// on a diagonal don't depend on each other
+void Texture::placeDiagonals(int &lastPercentage) {
+    std::vector<BlockPlacement> placements;
+    std::vector<GLint> chosen;
+    int placed = 0;
+    for (int d = 0; d < rows + cols - 1 && !cancelled; d++) {
+        int r0 = d < cols ? 0 : d - cols + 1;
+        int r1 = d < rows ? d : rows - 1;
+        if (d == 0)
+            placeBlock(0, 0);
+        else {
+            placements.clear();
+            for (int r = r0; r <= r1; r++)
+                placements.push_back(placement(r, d - r));
+            chosen.resize(placements.size());
+            sourceImage->findMinimumErrorBlocks(placements, targetImage, chosen.data());
+            for (int r = r0; r <= r1; r++)
+                layout.sourceIndex(r, d - r) = chosen[r - r0];
+        }
+        for (int r = r0; r <= r1; r++) {
+            placeWrapBorders(r, d - r);
+            reportProgress(++placed, lastPercentage);
+        }
+        effort.placed = placed;
+        
+        // This diagonal ends a row of blocks, and every row below it has been composited already
+        int finishedRow = d - (cols - 1);
+        if (finishedRow >= 0 && !tileable && !cancelled) {
+            for (int c = 0; c < cols; c++)
+                compositeBlock(finishedRow, c, 0, 0, width, height);
+            if (writer != NULL)
+                writer->rowsFinished(finishedRow + 1 < rows ? layout.posY(finishedRow + 1) : height);
+        }
+    }
+}
+
+// Print how far along generation is when it reaches another percent
+void Texture::reportProgress(int placed, int &lastPercentage) {
+    int newPercentage = placed * 100 / (rows * cols);
+    if (newPercentage > lastPercentage) {
+        std::cout << newPercentage << "%\n";
+        lastPercentage = newPercentage;
+    }
+}
+
+// The source block at row r, col c, or -1 if it is off the texture or hasn't been chosen yet
+// Tileable textures wrap around, so every position has neighbours
+int Texture::neighbourBlock(int r, int c) {
+    if (tileable) {
+        r = (r + rows) % rows;
+        c = (c + cols) % cols;
+    }
+    else if (r < 0 || r >= rows || c < 0 || c >= cols)
+        return -1;
+    return layout.sourceIndex(r, c);
+}
+
+// PatchMatch step for the block at row r, col c, matched against whichever of its four neighbours have blocks
+void Texture::improveBlock(int r, int c) {
+    int blockLeft = neighbourBlock(r, c-1), blockBelow = neighbourBlock(r-1, c);
+    int blockRight = neighbourBlock(r, c+1), blockAbove = neighbourBlock(r+1, c);
+    BlockMatch type = None;
+    if (blockLeft >= 0 && blockBelow >= 0)
+        type = Both;
+    else if (blockLeft >= 0)
+        type = Right;
+    else if (blockBelow >= 0)
+        type = Top;
+    layout.sourceIndex(r, c) = sourceImage->findPatchMatchBlock(layout.sourceIndex(r, c), blockLeft, blockBelow, type, targetImage, layout.posX(c), layout.posY(r), blockRight, blockAbove);
+}
+
+// Choose a block for every position with PatchMatch, before any border paths are calculated
+void Texture::searchPatchMatch() {
     for (int r = 0; r < rows; r++) {
-        for (int c = 0; c < cols; c++) {
-            // Create a new block for this row,col
-            block *curBlock = new block;
-            curBlock->borderPathLeft = new int[sourceImage->blockSize];
-            curBlock->borderPathBottom = new int[sourceImage->blockSize];
-            curBlock->x = c * (sourceImage->blockSize - sourceImage->borderSize);
-            curBlock->y = r * (sourceImage->blockSize - sourceImage->borderSize);
-            curBlock->size = sourceImage->blockSize;
-            
-            // Choose first block (lower left corner)
-            if (c == 0 && r == 0) {
-                if (targetImage != NULL)
-                    blockIndex = sourceImage->findMinimumErrorBlock(0, 0, None, NULL, NULL, targetImage, 0, 0);
-                else
-                    blockIndex = sourceImage->getRandomBlock();
-                // Zero out border paths
-                for (int i = 0; i < sourceImage->blockSize; i++) {
-                    curBlock->borderPathLeft[i] = 0;
-                    curBlock->borderPathBottom[i] = 0;
-                }
-            }
-            // For first row, only compare blocks horizontally
-            else if (r == 0) {
-                blockIndex = sourceImage->findMinimumErrorBlock(blockIndex, 0, BlockMatch::Right, curBlock->borderPathLeft, NULL, targetImage, curBlock->x, curBlock->y);
-                for (int i = 0; i < sourceImage->blockSize; i++)
-                    curBlock->borderPathBottom[i] = 0;
-            }
-            // For first col (along left edge) only compare blocks vertically
-            else if (c == 0) {
-                int blockBelow = blocks[(r-1)*cols + c]->sourceImageIndex;
-                blockIndex = sourceImage->findMinimumErrorBlock(0, blockBelow, BlockMatch::Top, NULL, curBlock->borderPathBottom, targetImage, curBlock->x, curBlock->y);
-                for (int i = 0; i < sourceImage->blockSize; i++)
-                    curBlock->borderPathLeft[i] = 0;
-            }
-            // For every other block, compare block to left and block below of new block
-            else {
-                int blockBelow = blocks[(r-1)*cols + c]->sourceImageIndex;
-                blockIndex = sourceImage->findMinimumErrorBlock(blockIndex, blockBelow, BlockMatch::Both, curBlock->borderPathLeft, curBlock->borderPathBottom, targetImage, curBlock->x, curBlock->y);
+        for (int c = 0; c < cols; c++)
+            layout.sourceIndex(r, c) = -1;
+    }
+    // Even passes go in placement order and odd passes go backwards,
+    // so good blocks propagate from both directions
+    for (int i = 0; i < patchMatchIterations && !cancelled; i++) {
+        double passStart = elapsedMs();
+        for (int n = 0; n < rows * cols && !cancelled; n++) {
+            int k = i % 2 == 0 ? n : rows * cols - 1 - n;
+            // Past the deadline the pass stops where it is, the first one leaving the blocks it didn't reach random
+            if (deadline > 0 && elapsedMs() > deadline) {
+                for (int m = n; m < rows * cols && i == 0; m++, effort.unsearched++)
+                    layout.sourceIndex(m / cols, m % cols) = sourceImage->getRandomBlock();
+                break;
             }
+            improveBlock(k / cols, k % cols);
+        }
+        std::cout << "PatchMatch pass " << i + 1 << "/" << patchMatchIterations << "\n";
+        effort.patchMatchPasses = i + 1;
+        // Under a deadline, stop when another pass and the border paths, which take about as long, wouldn't fit
+        double passTime = elapsedMs() - passStart;
+        if (deadline > 0 && elapsedMs() + 2 * passTime > deadline)
+            break;
+    }
+}
+
+// Calculate the border paths of the block already chosen for row r, col c against the blocks to the left and below
+void Texture::placeBorderPaths(int r, int c) {
+    GLubyte *borderPathLeft = layout.borderPathLeft(r, c);
+    GLubyte *borderPathBottom = layout.borderPathBottom(r, c);
+    for (int i = 0; i < sourceImage->blockSize; i++) {
+        borderPathLeft[i] = 0;
+        borderPathBottom[i] = 0;
+    }
+    // Past the deadline the rest of the blocks are left without border paths
+    if (deadline > 0 && elapsedMs() > deadline) {
+        effort.unseamed++;
+        return;
+    }
+    BlockMatch type = None;
+    if (c > 0 && r > 0)
+        type = Both;
+    else if (c > 0)
+        type = Right;
+    else if (r > 0)
+        type = Top;
+    int blockLeft = c > 0 ? layout.sourceIndex(r, c-1) : 0;
+    int blockBelow = r > 0 ? layout.sourceIndex(r-1, c) : 0;
+    sourceImage->getBorderPaths(layout.sourceIndex(r, c), blockLeft, blockBelow, type, borderPathLeft, borderPathBottom, targetImage, layout.posX(c), layout.posY(r));
+}
+
+// For tileable textures, calculate the border paths where the blocks at row r, col c wrap onto the first col and row
+void Texture::placeWrapBorders(int r, int c) {
+    if (!tileable)
+        return;
+    int blockIndex = layout.sourceIndex(r, c);
+    // The first block of this row is to the right of the last col, so it gets a left border path
+    if (c == cols - 1)
+        sourceImage->getBorderPaths(layout.sourceIndex(r, 0), blockIndex, 0, BlockMatch::Right, layout.borderPathLeft(r, 0), NULL, NULL, layout.posX(0), layout.posY(r));
+    // The first block of this col is above the last row, so it gets a bottom border path
+    if (r == rows - 1)
+        sourceImage->getBorderPaths(layout.sourceIndex(0, c), 0, blockIndex, BlockMatch::Top, NULL, layout.borderPathBottom(0, c), NULL, layout.posX(c), layout.posY(0));
+}
+
+// Composite the block at row r, col c into the output image, clipped to [x0, x1) x [y0, y1)
+void Texture::compositeBlock(int r, int c, int x0, int y0, int x1, int y1) {
+    GLubyte *clipPathRight = NULL, *clipPathTop = NULL;
+    if (tileable && c == cols - 1)
+        clipPathRight = layout.borderPathLeft(r, 0);
+    if (tileable && r == rows - 1)
+        clipPathTop = layout.borderPathBottom(0, c);
+    sourceImage->compositeBlock(layout.sourceIndex(r, c), layout.posX(c), layout.posY(r), layout.borderPathLeft(r, c), layout.borderPathBottom(r, c), clipPathRight, clipPathTop, outputImage, x0, y0, x1, y1, tileable);
+}
 
-            curBlock->sourceImageIndex = blockIndex;
-            blocks.push_back(curBlock);
+// Function to generate the data for this texture
+bool Texture::generateTexture() {
+    int lastPercentage = 0;
+    startTime = std::chrono::steady_clock::now();
+    blockCost = 0;
+    errorSum = matchedPixels = 0;
+    sampledBlocks = 0;
+    effort = SynthesisEffort();
+    layout.resize(cols, rows, sourceImage->blockSize, sourceImage->borderSize);
+    layout.tileable = tileable;
+    // PatchMatch chooses every block first, then the seams are cut between them below
+    if (search == PatchMatchSearch)
+        searchPatchMatch();
+    // Under a deadline, blocks are compared with fewer and fewer samples of the source as time runs out
+    bool sampled = search == ExhaustiveSearch && deadline > 0;
+    // When the source can find the blocks of many positions at once, they are placed a diagonal at a time
+    // and each row of blocks is composited once the diagonal with its last block is done
+    bool diagonals = search == ExhaustiveSearch && !sampled && sourceImage->batchesErrors(targetImage);
+    if (diagonals)
+        placeDiagonals(lastPercentage);
+    // Otherwise find an appropriate block and border path for every index in the texture
+    for (int r = 0; r < rows && !diagonals && !cancelled; r++) {
+        for (int c = 0; c < cols && !cancelled; c++) {
+            if (search == PatchMatchSearch)
+                placeBorderPaths(r, c);
+            else if (sampled)
+                placeSampledBlock(r, c, chooseSamples(r * cols + c));
+            else
+                placeBlock(r, c);
+            placeWrapBorders(r, c);
             
-            newPercentage = (int)blocks.size() * 100 / (rows * cols);
-            if (newPercentage > lastPercentage) {
-                std::cout << newPercentage << "%\n";
-                lastPercentage = newPercentage;
+            // Blocks are placed in the same order they have to be composited in
+            // Tileable textures keep changing the borders of the first col and row, so they are composited at the end
+            if (!tileable)
+                compositeBlock(r, c, 0, 0, width, height);
+            
+            effort.placed = r * cols + c + 1;
+            reportProgress(effort.placed, lastPercentage);
+        }
+        // The next row of blocks only overlaps the rows from its bottom up
+        if (writer != NULL && !tileable && !cancelled)
+            writer->rowsFinished(r + 1 < rows ? layout.posY(r + 1) : height);
+    }
+    
+    // A cancelled tileable texture has blocks missing, so it is left black
+    effort.cancelled = effort.placed < rows * cols;
+    if (tileable && !effort.cancelled)
+        compositeRegion(0, 0, width, height);
+    if (writer != NULL && !effort.cancelled)
+        writer->rowsFinished(height);
+    
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+    effort.elapsed = elapsed.count();
+    if (sampled && sampledBlocks > 0) {
+        effort.searchedFraction /= sampledBlocks;
+        effort.meanError = matchedPixels > 0 ? (double)errorSum / matchedPixels : 0;
+    }
+    else if (search == ExhaustiveSearch) {
+        effort.searchedFraction = 1;
+        effort.fullSearches = effort.placed;
+    }
+    if (deadline > 0 || effort.cancelled)
+        printEffort();
+    
+    // Cancelling applies to one run
+    cancelled = false;
+    return !effort.cancelled;
+}
+
+// Print how much of the search generateTexture did, for textures generated under a deadline or cancelled
+void Texture::printEffort() {
+    if (effort.cancelled)
+        std::cout << "Cancelled after " << effort.placed << " of " << rows * cols << " blocks\n";
+    if (deadline > 0)
+        std::cout << "Deadline " << deadline << " ms: generated in " << effort.elapsed << " ms, ";
+    if (search == PatchMatchSearch) {
+        std::cout << effort.patchMatchPasses << " of " << patchMatchIterations << " PatchMatch passes, "
+                  << effort.unsearched << " blocks left random, " << effort.unseamed << " placed without border paths\n";
+        return;
+    }
+    // One decimal is plenty
+    std::cout << "compared " << (int)(effort.searchedFraction * 1000) / 10.0 << "% of the source's blocks per block, "
+              << effort.fullSearches << " of " << effort.placed << " blocks fully searched, "
+              << effort.unseamed << " placed without border paths";
+    if (effort.meanError > 0)
+        std::cout << ", mean error " << (int)(effort.meanError * 10) / 10.0 << " per matched pixel";
+    std::cout << "\n";
+}
+
+// Choose new blocks for every block position in [col0, col1] x [row0, row1]
+// The rest of the layout is kept, only the blocks directly to the right of and above the region
+// get their border paths recalculated, since those depend on the new blocks through their left/below constraints
+void Texture::resynthesizeRegion(int col0, int row0, int col1, int row1) {
+    if (layout.empty()) {
+        std::cout << "Texture must be generated before it can be resynthesized.\n";
+        return;
+    }
+    
+    // Clamp region to the texture
+    if (col0 < 0) col0 = 0;
+    if (row0 < 0) row0 = 0;
+    if (col1 >= cols) col1 = cols - 1;
+    if (row1 >= rows) row1 = rows - 1;
+    if (col0 > col1 || row0 > row1)
+        return;
+    
+    std::cout << "Resynthesizing blocks [" << col0 << "," << row0 << "] to [" << col1 << "," << row1 << "]\n";
+    
+    // Choose new blocks in the same order as generateTexture, so every block's left and below neighbors are final
+    for (int r = row0; r <= row1; r++) {
+        for (int c = col0; c <= col1; c++)
+            placeBlock(r, c);
+    }
+    
+    // Blocks right of the region keep their source block, but need a new left border path
+    // For tileable textures, the block right of the last col is the first col, and the first col
+    // always needs its left border path recalculated if it was replaced
+    for (int r = row0; r <= row1; r++) {
+        if (tileable) {
+            placeWrapBorders(r, cols - 1);
+            if (col1 + 1 == cols)
+                continue;
+        }
+        if (col1 + 1 < cols)
+            sourceImage->getBorderPaths(layout.sourceIndex(r, col1 + 1), layout.sourceIndex(r, col1), 0, BlockMatch::Right, layout.borderPathLeft(r, col1 + 1), NULL, targetImage, layout.posX(col1 + 1), layout.posY(r));
+    }
+    // Blocks above the region keep their source block, but need a new bottom border path
+    for (int c = col0; c <= col1; c++) {
+        if (tileable) {
+            placeWrapBorders(rows - 1, c);
+            if (row1 + 1 == rows)
+                continue;
+        }
+        if (row1 + 1 < rows)
+            sourceImage->getBorderPaths(layout.sourceIndex(row1 + 1, c), 0, layout.sourceIndex(row1, c), BlockMatch::Top, NULL, layout.borderPathBottom(row1 + 1, c), targetImage, layout.posX(c), layout.posY(row1 + 1));
+    }
+    
+    // Regions touching the edges of a tileable texture change pixels on the opposite edges too
+    if (tileable && (col0 == 0 || row0 == 0 || col1 == cols - 1 || row1 == rows - 1)) {
+        compositeRegion(0, 0, width, height);
+        return;
+    }
+    
+    // Every pixel that changed lies within the area covered by the blocks of the region
+    int step = sourceImage->blockSize - sourceImage->borderSize;
+    compositeRegion(col0 * step, row0 * step, col1 * step + sourceImage->blockSize, row1 * step + sourceImage->blockSize);
+}
+
+// Recomposite the pixels in [x0, x1) x [y0, y1) from every block that covers them
+void Texture::compositeRegion(int x0, int y0, int x1, int y1) {
+    int step = sourceImage->blockSize - sourceImage->borderSize;
+    
+    // Block c covers [c * step, c * step + blockSize), find the range of blocks that overlap the region
+    int col0 = x0 < sourceImage->blockSize ? 0 : (x0 - sourceImage->blockSize) / step + 1;
+    int row0 = y0 < sourceImage->blockSize ? 0 : (y0 - sourceImage->blockSize) / step + 1;
+    int col1 = (x1 - 1) / step, row1 = (y1 - 1) / step;
+    if (col1 >= cols) col1 = cols - 1;
+    if (row1 >= rows) row1 = rows - 1;
+    
+    if (x1 > width) x1 = width;
+    if (y1 > height) y1 = height;
+    
+    // Composite in placement order so overlapping borders are resolved the same way as in generateTexture
+    for (int r = row0; r <= row1; r++) {
+        for (int c = col0; c <= col1; c++)
+            compositeBlock(r, c, x0, y0, x1, y1);
+    }
+}
+
+// Write the block layout to filename so the texture can be recreated without generating it again
+bool Texture::saveLayout(const char *filename) {
+    if (layout.empty()) {
+        std::cout << "Texture must be generated before its layout can be saved.\n";
+        return false;
+    }
+    return layout.save(filename);
+}
+
+// Read a block layout saved by saveLayout and composite it, instead of generating the texture
+bool Texture::loadLayout(const char *filename) {
+    if (!layout.load(filename))
+        return false;
+    if (layout.cols != cols || layout.rows != rows || layout.blockSize != sourceImage->blockSize || layout.borderSize != sourceImage->borderSize) {
+        std::cout << filename << " was saved for a different texture size, block size or border size.\n";
+        layout.resize(0, 0, 0, 0);
+        return false;
+    }
+    // Tileable layouts have border paths for the seams that wrap around, which other textures don't
+    if (layout.tileable != tileable) {
+        std::cout << filename << (layout.tileable ? " was saved for a tileable texture.\n" : " was saved for a texture that isn't tileable.\n");
+        layout.resize(0, 0, 0, 0);
+        return false;
+    }
+    // Every block must be one of the source's
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            if (layout.sourceIndex(r, c) < 0 || layout.sourceIndex(r, c) >= sourceImage->getNumBlocks()) {
+                std::cout << filename << " places blocks the source image doesn't have.\n";
+                layout.resize(0, 0, 0, 0);
+                return false;
             }
         }
     }
+    compositeRegion(0, 0, width, height);
+    return true;
 }
 
 void Texture::drawTexture() {
-    // Draw each block in the source image to this texture
-    for (int i = 0; i < blocks.size(); i++) {
-        sourceImage->drawBlock(blocks[i]->sourceImageIndex, blocks[i]->x, blocks[i]->y, blocks[i]->borderPathLeft, blocks[i]->borderPathBottom);
-    }
-}
\ No newline at end of file
+    // Blocks have already been composited into the output image
+    outputImage->drawFullImage();
+}
@@ -11,35 +11,91 @@
 
 #include <stdio.h>
 #include <vector>
+#include <atomic>
+#include <chrono>
 #include "SourceImage.hpp"
 #include "Image.hpp"
+#include "BlockLayout.hpp"
+#include "ImageWriter.hpp"
 
-struct block {
-    int sourceImageIndex;
-    int x;
-    int y;
-    int size;
-    int *borderPathLeft;
-    int *borderPathBottom;
+// How much searching generateTexture did and how well its blocks matched, to see what a deadline cost
+struct SynthesisEffort {
+    int placed;                 // blocks placed, fewer than the texture has if it was cancelled
+    int fullSearches;           // blocks compared against every block of the source
+    int unseamed;               // blocks placed at random without border paths once the deadline had passed
+    int unsearched;             // blocks the first PatchMatch pass hadn't reached by the deadline, left at random
+    double searchedFraction;    // average fraction of the source's blocks compared for each block
+    double meanError;           // average error of the placed blocks per pixel they were matched on
+    int patchMatchPasses;
+    long long elapsed;          // milliseconds
+    bool cancelled;
 };
 
 class Texture {
 private:
-    // A list of which blocks to draw to the texture, reference index from sourceImage
-    std::vector<block*> blocks;
+    // Which blocks to draw to the texture, reference index from sourceImage
+    BlockLayout layout;
     SourceImage *sourceImage;
     Image *targetImage;
+    // The composited texture, blocks are written into it as they are placed
+    Image *outputImage;
+    // If set, told about the rows of the output image that are finished as blocks are placed
+    ImageWriter *writer;
     int cols, rows;
     int width, height;
+    // Whether the texture wraps around its edges
+    bool tileable;
+    SearchStrategy search;
+    // Milliseconds generateTexture has to finish in, 0 for none, and how long comparing one block has been taking
+    int deadline;
+    double blockCost;
+    std::chrono::steady_clock::time_point startTime;
+    std::atomic<bool> cancelled;
+    SynthesisEffort effort;
+    // Totals over the blocks placed by placeSampledBlock
+    long long errorSum, matchedPixels;
+    int sampledBlocks;
+    double elapsedMs();
+    int chooseSamples(int placed);
+    void placeSampledBlock(int r, int c, int samples);
+    void printEffort();
+    int neighbourBlock(int r, int c);
+    BlockPlacement placement(int r, int c);
+    void placeBlock(int r, int c);
+    void placeDiagonals(int &lastPercentage);
+    void reportProgress(int placed, int &lastPercentage);
+    void improveBlock(int r, int c);
+    void placeBorderPaths(int r, int c);
+    void searchPatchMatch();
+    void placeWrapBorders(int r, int c);
+    void compositeBlock(int r, int c, int x0, int y0, int x1, int y1);
+    void compositeRegion(int x0, int y0, int x1, int y1);
 public:
     Texture();
-    Texture(SourceImage *sImage, int w, int h);
+    Texture(SourceImage *sImage, int w, int h, bool tile = false);
     Texture(SourceImage *sImage, Image *tImage);
     ~Texture();
-    void generateTexture();
+    void setSearch(SearchStrategy s) { search = s; }
+    // Finish generateTexture within ms milliseconds by searching less as time runs out, 0 for no deadline
+    void setDeadline(int ms) { deadline = ms; }
+    // Write the rows of the texture with writer while generateTexture is still placing the blocks above them
+    void setWriter(ImageWriter *w) { writer = w; }
+    // Stop generateTexture once the block it is placing is done, from any thread; the texture is left unfinished
+    void cancel() { cancelled = true; }
+    // Returns false if it was cancelled
+    bool generateTexture();
+    const SynthesisEffort &getEffort() { return effort; }
+    void resynthesizeRegion(int col0, int row0, int col1, int row1);
+    bool saveLayout(const char *filename);
+    bool loadLayout(const char *filename);
     void drawTexture();
     int getWidth();
     int getHeight();
+    Image *getOutputImage() { return outputImage; }
+    // The image being redrawn by transfer, NULL for synthesis
+    Image *getTargetImage() { return targetImage; }
+    int getCols() { return cols; }
+    int getRows() { return rows; }
 };
 
 #endif /* Texture_hpp */
@@ -0,0 +1,233 @@
+//
+//  TiledSource.cpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#include "TiledSource.hpp"
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Pages are about this many pixels on a side, unless the memory cap is too small for that
+static const int pageSide = 512;
+// Pages a placement can hold at once: those of the four blocks it is matched against, and the one being scanned
+static const int pagesInUse = 5;
+
+// Open the source image at filename
+// Sources that can't be opened are left without pages, and getError says why, like Image
+TiledSource::TiledSource(const char *filename, GLsizei blockS, GLsizei borderS, size_t cap) {
+    std::string fname = (std::string)filename;
+    size_t dot = fname.find_last_of(".");
+    std::string extension = dot == std::string::npos ? "" : fname.substr(dot);
+    width = height = 0;
+    numCols = numRows = pageBlocks = pageCols = pageRows = 0;
+    step = blockS - borderS;
+    blockSize = blockS;
+    memoryCap = cap;
+    liveBytes = 0;
+    peakBytes = 0;
+    loads = evictions = 0;
+    readFailed = false;
+    file = -1;
+    FILE *header = fopen(filename, "rb");
+    if (header == NULL) {
+        fail(fname + " cannot be read.");
+        return;
+    }
+    
+    // Same layouts Image reads: ppm rows go from the top down, bmp rows from the bottom up in BGR order
+    bool ok = false;
+    if (extension.compare(".ppm") == 0) {
+        // line with file type, line with width and height, line with max value
+        char line[80];
+        ok = fgets(line, 80, header) != NULL && line[0] == 'P' && line[1] == '6' &&
+             fgets(line, 80, header) != NULL && sscanf(line, "%d %d", &width, &height) == 2 &&
+             fgets(line, 80, header) != NULL;
+        dataOffset = ftell(header);
+        topDown = true;
+        bgr = false;
+    }
+    else if (extension.compare(".bmp") == 0) {
+        GLubyte info[54];
+        ok = fread(info, sizeof(GLubyte), 54, header) == 54;
+        width = *(int*)&info[18];
+        height = *(int*)&info[22];
+        dataOffset = 54;
+        topDown = false;
+        bgr = true;
+    }
+    fclose(header);
+    
+    struct stat info;
+    file = open(filename, O_RDONLY);
+    if (!ok || width < blockSize || height < blockSize || file < 0 || fstat(file, &info) != 0) {
+        fail(fname + " cannot be read as a tiled source, only binary ppm and bmp files can.");
+        return;
+    }
+    if (info.st_size < dataOffset + (long)width * height * 3) {
+        fail(fname + " is truncated.");
+        return;
+    }
+    
+    numCols = 1 + (width - blockSize) / step;
+    numRows = 1 + (height - blockSize) / step;
+    
+    // Pages get smaller until as many as a placement uses at once fit in the cap
+    pageBlocks = pageSide / step > 1 ? pageSide / step : 1;
+    while (pageBlocks > 1 && (size_t)pageWidth(pageBlocks) * pageWidth(pageBlocks) * 3 * pagesInUse > memoryCap)
+        pageBlocks /= 2;
+    if ((size_t)pageWidth(pageBlocks) * pageWidth(pageBlocks) * 3 * pagesInUse > memoryCap) {
+        fail("Source memory cap is smaller than one block.");
+        return;
+    }
+    pageCols = (numCols + pageBlocks - 1) / pageBlocks;
+    pageRows = (numRows + pageBlocks - 1) / pageBlocks;
+    
+    pins.assign(pageCols * pageRows, 0);
+    std::cout << "Tiled source " << filename << ": width:" << width << " height:" << height << ", "
+              << pageCols * pageRows << " pages of " << pageBlocks << "x" << pageBlocks << " blocks, "
+              << memoryCap / (1024 * 1024) << " MB cap\n";
+}
+
+TiledSource::~TiledSource() {
+    if (file >= 0)
+        close(file);
+}
+
+void TiledSource::fail(const std::string &message) {
+    error = message;
+    std::cout << error << "\n";
+    width = height = 0;
+    numCols = numRows = pageCols = pageRows = 0;
+}
+
+int TiledSource::pageOf(GLint index) {
+    return (index / numCols / pageBlocks) * pageCols + (index % numCols) / pageBlocks;
+}
+
+void TiledSource::pageBlocksOf(int page, GLint &col0, GLint &row0, GLint &cols, GLint &rows) {
+    col0 = (page % pageCols) * pageBlocks;
+    row0 = (page / pageCols) * pageBlocks;
+    cols = numCols - col0 < pageBlocks ? numCols - col0 : pageBlocks;
+    rows = numRows - row0 < pageBlocks ? numRows - row0 : pageBlocks;
+}
+
+size_t TiledSource::pageBytes(int page) {
+    GLint col0, row0, cols, rows;
+    pageBlocksOf(page, col0, row0, cols, rows);
+    return (size_t)pageWidth(cols) * pageWidth(rows) * 3;
+}
+
+// Read page from the file
+TiledSource::Page TiledSource::loadPage(int page) {
+    GLint col0, row0, cols, rows;
+    pageBlocksOf(page, col0, row0, cols, rows);
+    GLint w = pageWidth(cols), h = pageWidth(rows);
+    GLint x0 = col0 * step, y0 = row0 * step;
+    
+    // The page counts against the cap until its last user lets go of it
+    std::shared_ptr<std::vector<GLubyte> > pixels(new std::vector<GLubyte>(w * h * 3), [this](std::vector<GLubyte> *p) {
+        liveBytes -= p->size();
+        delete p;
+    });
+    liveBytes += pixels->size();
+    for (int y = 0; y < h; y++) {
+        // Rows of the page go from the bottom up, like Image
+        long fileRow = topDown ? height - 1 - (y0 + y) : y0 + y;
+        GLubyte *row = &(*pixels)[y * w * 3];
+        // The file changed since it was opened: the page is left black, and the source reports it failed
+        if (pread(file, row, w * 3, dataOffset + (fileRow * width + x0) * 3) != w * 3) {
+            if (!readFailed.exchange(true))
+                std::cout << "Source image page cannot be read.\n";
+            memset(row, 0, w * 3);
+            continue;
+        }
+        if (bgr) {
+            for (int x = 0; x < w * 3; x += 3)
+                std::swap(row[x], row[x + 2]);
+        }
+    }
+    return pixels;
+}
+
+TiledSource::Page TiledSource::getPage(int page) {
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        for (auto it = cache.begin(); it != cache.end(); it++) {
+            if (it->first == page) {
+                // Move to the front, it is now the most recently used
+                cache.splice(cache.begin(), cache, it);
+                return cache.front().second;
+            }
+        }
+        
+        // Make room first, so the pages alive never add up to more than the cap
+        // Dropping a page another job is still using doesn't free it, so more pages are dropped until they fit,
+        // but pinned pages are kept, and if only they are left the page is read anyway
+        size_t size = pageBytes(page);
+        auto it = cache.end();
+        while (liveBytes + size > memoryCap && it != cache.begin()) {
+            it--;
+            if (pins[it->first] == 0) {
+                it = cache.erase(it);
+                evictions++;
+            }
+        }
+    }
+    
+    // Read outside of the lock so other jobs can keep using the pages in memory
+    Page pixels = loadPage(page);
+    
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    for (auto it = cache.begin(); it != cache.end(); it++) {
+        // Another job read it at the same time
+        if (it->first == page)
+            return it->second;
+    }
+    cache.push_front(std::make_pair(page, pixels));
+    loads++;
+    if (liveBytes > peakBytes)
+        peakBytes = liveBytes;
+    return pixels;
+}
+
+std::vector<int> TiledSource::pinResident() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    // Only pages nothing else is using could be dropped to make room, the rest stay in memory either way
+    // and are pinned for free
+    size_t keptBytes = liveBytes;
+    for (auto it = cache.begin(); it != cache.end(); it++) {
+        if (pins[it->first] == 0 && it->second.use_count() == 1)
+            keptBytes -= it->second->size();
+    }
+    size_t room = (size_t)pageWidth(pageBlocks) * pageWidth(pageBlocks) * 3;
+    std::vector<int> pinned;
+    for (auto it = cache.begin(); it != cache.end(); it++) {
+        if (pins[it->first] == 0 && it->second.use_count() == 1) {
+            if (keptBytes + it->second->size() + room > memoryCap)
+                continue;
+            keptBytes += it->second->size();
+        }
+        pins[it->first]++;
+        pinned.push_back(it->first);
+    }
+    return pinned;
+}
+
+void TiledSource::unpin(const std::vector<int> &pages) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    for (size_t i = 0; i < pages.size(); i++)
+        pins[pages[i]]--;
+}
+
+void TiledSource::printReport() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    std::cout << "Source pages: peak " << peakBytes / 1024 << " KB of " << memoryCap / 1024 << " KB cap, "
+              << liveBytes / 1024 << " KB still in use, " << loads << " loads, " << evictions << " evictions\n";
+}
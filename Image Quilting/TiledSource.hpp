@@ -0,0 +1,83 @@
+//
+//  TiledSource.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef TiledSource_hpp
+#define TiledSource_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+// A source image that is read from its file a page at a time, for sources too large to keep in memory
+// Pages are squares of whole blocks from the source's block grid, each with every pixel of its blocks,
+// so any block can be read from a single page; neighbouring pages share the borders between their blocks
+// Pages are kept in memory, least recently used first out, while they fit in the memory cap
+// Every page still in use counts against the cap, whether it is kept or was already dropped
+class TiledSource {
+public:
+    // The pixels of a page, bottom up packed RGB like Image, kept alive while a page is being used
+    typedef std::shared_ptr<const std::vector<GLubyte> > Page;
+private:
+    int file;
+    // Where the pixels start in the file and how they are stored there
+    long dataOffset;
+    bool topDown, bgr;
+    GLint step, blockSize;
+    // Blocks in the source, blocks per page side and pages in the source
+    GLint numCols, numRows, pageBlocks, pageCols, pageRows;
+    size_t memoryCap;
+    
+    // Pages in memory, most recently used first, and how many scans have pinned each page there
+    std::list<std::pair<int, Page> > cache;
+    std::vector<int> pins;
+    std::mutex cacheMutex;
+    // Bytes of every page that is still alive, decremented when the last user lets go of it
+    std::atomic<size_t> liveBytes;
+    size_t peakBytes;
+    long loads, evictions;
+    // Why the source couldn't be opened, and whether any page couldn't be read since
+    std::string error;
+    std::atomic<bool> readFailed;
+    
+    void fail(const std::string &message);
+    size_t pageBytes(int page);
+    Page loadPage(int page);
+public:
+    // Sources that can't be opened have no pages and getError says why, it is empty for sources that were opened
+    TiledSource(const char *filename, GLsizei blockS, GLsizei borderS, size_t cap);
+    ~TiledSource();
+    const std::string &getError() const { return error; }
+    // Whether a page couldn't be read after the source was opened, because the file changed; such pages are black
+    bool pageReadFailed() const { return readFailed; }
+    GLsizei width, height;
+    int numPages() { return pageCols * pageRows; }
+    // the page holding block index
+    int pageOf(GLint index);
+    // the first block col and row of page, how many blocks wide and high it is, and its width in pixels
+    void pageBlocksOf(int page, GLint &col0, GLint &row0, GLint &cols, GLint &rows);
+    GLint pageWidth(GLint cols) { return (cols - 1) * step + blockSize; }
+    // The pixels of page, read from the file if it isn't in memory
+    Page getPage(int page);
+    // Pin pages in memory, most recently used first, while they and the pages in use leave room under the cap to read one more,
+    // and return them; pinned pages are not dropped until they are unpinned
+    std::vector<int> pinResident();
+    void unpin(const std::vector<int> &pages);
+    // Print how much memory the pages used against the cap
+    void printReport();
+};
+
+#endif /* TiledSource_hpp */
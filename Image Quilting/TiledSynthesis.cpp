@@ -0,0 +1,460 @@
+//
+//  TiledSynthesis.cpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#include "TiledSynthesis.hpp"
+#include "SourceImage.hpp"
+#include "Texture.hpp"
+#include "AutoTuner.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// How many times a tile is handed out before giving up on it
+static const int maxAttempts = 3;
+// Workers touch their claim this often, and a claim that hasn't been touched for staleSeconds is handed out again
+static const int heartbeatSeconds = 2;
+static const int staleSeconds = 30;
+
+static std::string getHostName() {
+    char name[256];
+    if (gethostname(name, sizeof(name)) != 0)
+        return "localhost";
+    name[sizeof(name) - 1] = '\0';
+    return name;
+}
+
+static bool fileExists(const std::string &path) {
+    return access(path.c_str(), F_OK) == 0;
+}
+
+static bool endsWith(const std::string &s, const std::string &suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static std::vector<std::string> listFiles(const std::string &dir) {
+    std::vector<std::string> names;
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL)
+        return names;
+    while (dirent *entry = readdir(d))
+        names.push_back(entry->d_name);
+    closedir(d);
+    return names;
+}
+
+// Everything a tile's pixels depend on, so tiles left in the directory are only reused for the same job
+static std::string tileJobKey(const Job &job) {
+    struct stat info;
+    time_t modified = stat(job.sourcePath.c_str(), &info) == 0 ? info.st_mtime : 0;
+    std::ostringstream key;
+    key << job.sourceKey() << "|" << modified << "|" << job.width << "|" << job.height << "|" << job.tileSize << "|";
+    key << (job.autoSearch ? "auto" : job.search == PatchMatchSearch ? "patchmatch" : "exhaustive") << "\n";
+    return key.str();
+}
+
+TiledSynthesis::TiledSynthesis(const Job &j) {
+    job = j;
+    hostName = getHostName();
+    // Seams between tiles are found the same way as seams between blocks, but through a whole block's width,
+    // limited to what a border path can hold
+    overlap = job.blockSize < 256 ? job.blockSize : 256;
+    
+    // Any leftover that doesn't make a whole tile goes to the last column or row
+    cols = job.width / job.tileSize > 0 ? job.width / job.tileSize : 1;
+    rows = job.height / job.tileSize > 0 ? job.height / job.tileSize : 1;
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            Tile tile;
+            std::ostringstream name;
+            name << "tile_" << r << "_" << c;
+            tile.name = name.str();
+            tile.x = c * job.tileSize;
+            tile.y = r * job.tileSize;
+            int right = c == cols - 1 ? job.width : std::min(job.width, tile.x + job.tileSize + overlap);
+            int top = r == rows - 1 ? job.height : std::min(job.height, tile.y + job.tileSize + overlap);
+            tile.width = right - tile.x;
+            tile.height = top - tile.y;
+            tile.attempts = 0;
+            tiles.push_back(tile);
+        }
+    }
+}
+
+std::string TiledSynthesis::path(const std::string &name) const {
+    return dir + "/" + name;
+}
+
+// Write the arguments for tile's texture where workers will find them
+bool TiledSynthesis::writeTileJob(const Tile &tile) {
+    std::string tmpPath = path(tile.name + ".tmp");
+    std::ofstream file(tmpPath.c_str());
+    file << job.sourcePath << "\n" << job.blockSize << "\n" << job.borderSize << "\n" << job.randomness << "\n";
+    file << tile.width << "\n" << tile.height << "\n";
+    file << "--metric\n" << metricName(job.metric) << "\n";
+    file << "--source-memory\n" << job.sourceMemory << "\n";
+    file << "--pixels\n" << pixelLayoutName(job.pixelLayout) << "\n";
+    file << "--search\n" << (job.autoSearch ? "auto" : job.search == PatchMatchSearch ? "patchmatch" : "exhaustive") << "\n";
+    if (!job.tuningPath.empty())
+        file << "--tuning\n" << job.tuningPath << "\n";
+    file << "--output\n" << path(tile.name + ".qoi") << "\n";
+    file.close();
+    // Renamed into place so workers never see half a job
+    if (file.fail() || rename(tmpPath.c_str(), path(tile.name + ".job").c_str()) != 0) {
+        std::cout << tmpPath << " cannot be written.\n";
+        return false;
+    }
+    return true;
+}
+
+// Hand tile out again by moving the claim or failure file at from back to its job file
+// Returns false if the tile has failed too many times
+bool TiledSynthesis::retry(Tile &tile, const std::string &from, const char *reason) {
+    tile.attempts++;
+    std::cout << "Tile " << tile.name << ": " << reason;
+    if (tile.attempts >= maxAttempts) {
+        std::cout << ", giving up after " << tile.attempts << " attempts\n";
+        unlink(from.c_str());
+        return false;
+    }
+    std::cout << ", retrying\n";
+    return rename(from.c_str(), path(tile.name + ".job").c_str()) == 0;
+}
+
+// Hand out the tiles and wait for them to be finished, keeping processes local workers running
+bool TiledSynthesis::generateTiles() {
+    // Tiles left over from an earlier run of the same job are reused, and any others are cleared out
+    std::string key = tileJobKey(job);
+    std::ifstream manifestFile(path("manifest").c_str());
+    std::string manifest((std::istreambuf_iterator<char>(manifestFile)), std::istreambuf_iterator<char>());
+    manifestFile.close();
+    if (manifest != key) {
+        std::vector<std::string> names = listFiles(dir);
+        for (size_t n = 0; n < names.size(); n++) {
+            if (names[n].compare(0, 5, "tile_") == 0)
+                unlink(path(names[n]).c_str());
+        }
+        std::string tmpPath = path("manifest.tmp");
+        std::ofstream file(tmpPath.c_str());
+        file << key;
+        file.close();
+        if (file.fail() || rename(tmpPath.c_str(), path("manifest").c_str()) != 0) {
+            std::cout << tmpPath << " cannot be written.\n";
+            return false;
+        }
+    }
+    
+    int finished = 0;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        unlink(path(tiles[i].name + ".failed").c_str());
+        GLsizei w, h;
+        if (Image::readDimensions(path(tiles[i].name + ".qoi").c_str(), &w, &h) && w == tiles[i].width && h == tiles[i].height)
+            finished++;
+        else if (!writeTileJob(tiles[i]))
+            return false;
+    }
+    
+    bool ok = true;
+    int lastFinished = -1;
+    while (ok) {
+        // Tiles claimed by local workers that crashed are handed out again
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            workers.erase(std::remove(workers.begin(), workers.end(), pid), workers.end());
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+                continue;
+            std::ostringstream suffix;
+            suffix << ".job." << hostName << "." << pid;
+            for (size_t i = 0; i < tiles.size() && ok; i++) {
+                std::string claim = path(tiles[i].name + suffix.str());
+                if (fileExists(claim))
+                    ok = retry(tiles[i], claim, "worker crashed");
+            }
+        }
+        
+        // Check on every tile that isn't finished
+        std::vector<std::string> names = listFiles(dir);
+        time_t now = time(0);
+        int pending = 0;
+        finished = 0;
+        for (size_t i = 0; i < tiles.size() && ok; i++) {
+            Tile &tile = tiles[i];
+            if (fileExists(path(tile.name + ".qoi"))) {
+                finished++;
+                continue;
+            }
+            if (fileExists(path(tile.name + ".failed"))) {
+                ok = retry(tile, path(tile.name + ".failed"), "worker failed");
+                continue;
+            }
+            // Claims that haven't been touched belong to workers that died on another machine
+            for (size_t n = 0; n < names.size() && ok; n++) {
+                struct stat info;
+                if (names[n].compare(0, tile.name.size() + 5, tile.name + ".job.") == 0 &&
+                    stat(path(names[n]).c_str(), &info) == 0 && now - info.st_mtime > staleSeconds)
+                    ok = retry(tile, path(names[n]), "claim went stale");
+            }
+            if (fileExists(path(tile.name + ".job")))
+                pending++;
+        }
+        if (!ok)
+            break;
+        
+        if (finished != lastFinished) {
+            std::cout << "Tiles finished: " << finished << "/" << tiles.size() << "\n";
+            lastFinished = finished;
+        }
+        if (finished == (int)tiles.size())
+            break;
+        
+        // Start local workers for waiting tiles
+        while ((int)workers.size() < job.processes && (int)workers.size() < pending) {
+            std::cout.flush();
+            fflush(stdout);
+            pid_t child = fork();
+            if (child == 0) {
+                runTileWorker(dir, false);
+                std::cout.flush();
+                _exit(0);
+            }
+            if (child < 0) {
+                std::cout << "Worker process cannot be started: " << strerror(errno) << "\n";
+                break;
+            }
+            workers.push_back(child);
+        }
+        
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    
+    // Let workers on other machines know they can stop
+    std::ofstream(path("done").c_str());
+    if (!ok) {
+        for (size_t i = 0; i < workers.size(); i++)
+            kill(workers[i], SIGTERM);
+    }
+    for (size_t i = 0; i < workers.size(); i++)
+        waitpid(workers[i], NULL, 0);
+    workers.clear();
+    return ok;
+}
+
+// Draw tileImage into outputImage, cutting it along the minimum error paths through its overlaps with
+// the tiles to its left and below, which are already drawn
+void TiledSynthesis::stitchTile(const Tile &tile, Image *tileImage, Image *outputImage) {
+    int leftWidth = tile.x > 0 ? std::min(overlap, tile.width) : 0;
+    int bottomHeight = tile.y > 0 ? std::min(overlap, tile.height) : 0;
+    std::vector<GLubyte> leftPath(tile.height, 0), bottomPath(tile.width, 0);
+    ImageView placed = tileImage->view(), drawn = outputImage->view().subView(tile.x, tile.y, tile.width, tile.height);
+    GLubyte *tileData = tileImage->getData(), *outputData = outputImage->getData();
+    
+    // The left overlap runs up the rows, the cut goes through one pixel of each row
+    if (leftWidth > 0) {
+        std::vector<int> errors(tile.height * leftWidth);
+        borderErrors(job.metric, drawn.subView(0, 0, leftWidth, tile.height), placed.subView(0, 0, leftWidth, tile.height), errors.data());
+        minimumErrorCut(errors.data(), tile.height, leftWidth, leftPath.data());
+    }
+    // The bottom overlap runs along the columns, the cut goes through one pixel of each column,
+    // so its errors are turned to run along the columns too
+    if (bottomHeight > 0) {
+        std::vector<int> errors(tile.width * bottomHeight), columnErrors(tile.width * bottomHeight);
+        borderErrors(job.metric, drawn.subView(0, 0, tile.width, bottomHeight), placed.subView(0, 0, tile.width, bottomHeight), errors.data());
+        for (int y = 0; y < bottomHeight; y++) {
+            for (int x = 0; x < tile.width; x++)
+                columnErrors[x * bottomHeight + y] = errors[y * tile.width + x];
+        }
+        minimumErrorCut(columnErrors.data(), tile.width, bottomHeight, bottomPath.data());
+    }
+    
+    // Draw the tile to the right of the left cut and above the bottom cut
+    for (int y = 0; y < tile.height; y++) {
+        for (int x = 0; x < tile.width; x++) {
+            if (x >= leftPath[y] && (y >= bottomHeight || y >= bottomPath[x]))
+                memcpy(outputData + ((tile.y + y) * outputImage->width + tile.x + x) * 3, tileData + (y * tile.width + x) * 3, 3);
+        }
+    }
+}
+
+bool TiledSynthesis::run() {
+    auto start = std::chrono::steady_clock::now();
+    
+    // Workers may run elsewhere, so they get absolute paths
+    char resolved[PATH_MAX];
+    if (realpath(job.sourcePath.c_str(), resolved) != NULL)
+        job.sourcePath = resolved;
+    if (job.tileDir.empty()) {
+        char tmpDir[] = "/tmp/iq-tiles-XXXXXX";
+        if (mkdtemp(tmpDir) == NULL) {
+            std::cout << "Tile directory cannot be created: " << strerror(errno) << "\n";
+            return false;
+        }
+        dir = tmpDir;
+    }
+    else {
+        if (mkdir(job.tileDir.c_str(), 0777) != 0 && errno != EEXIST) {
+            std::cout << job.tileDir << " cannot be created: " << strerror(errno) << "\n";
+            return false;
+        }
+        dir = realpath(job.tileDir.c_str(), resolved) != NULL ? resolved : job.tileDir;
+    }
+    unlink(path("done").c_str());
+    // Workers load the measurements for --search auto, so they are taken here once rather than by every worker at once
+    if (job.autoSearch)
+        loadOrCalibrate(job.tuningPath);
+    std::cout << "Synthesizing " << cols << "x" << rows << " tiles with " << job.processes << " processes in " << dir << "\n";
+    
+    if (!generateTiles())
+        return false;
+    
+    // Stitch the tiles in the same order blocks are placed, from the bottom left
+    Image outputImage(job.width, job.height);
+    for (size_t i = 0; i < tiles.size(); i++) {
+        std::string tilePath = path(tiles[i].name + ".qoi");
+        GLsizei w, h;
+        if (!Image::readDimensions(tilePath.c_str(), &w, &h) || w != tiles[i].width || h != tiles[i].height) {
+            std::cout << tilePath << " is not the right size.\n";
+            return false;
+        }
+        Image tileImage(tilePath.c_str());
+        if (!tileImage.getReadError().empty())
+            return false;
+        stitchTile(tiles[i], &tileImage, &outputImage);
+    }
+    if (!outputImage.writeFile(job.outputPath.c_str()))
+        return false;
+    
+    // A temporary directory's tiles can't be reused by another run, so it goes once the texture is written
+    if (job.tileDir.empty()) {
+        std::vector<std::string> names = listFiles(dir);
+        for (size_t n = 0; n < names.size(); n++) {
+            if (names[n] != "." && names[n] != "..")
+                unlink(path(names[n]).c_str());
+        }
+        rmdir(dir.c_str());
+    }
+    
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Generated tiled texture in " << elapsed.count() << " ms\n";
+    return true;
+}
+
+void runTileWorker(const std::string &dir, bool untilDone) {
+    std::ostringstream claimSuffix;
+    claimSuffix << "." << getHostName() << "." << getpid();
+    
+    // Consecutive tiles usually share a source image, so it is only prepared again when it changes
+    std::unique_ptr<SourceImage> source;
+    std::string sourceKey;
+    
+    while (true) {
+        // Claim a waiting tile by renaming its job file, only one worker can succeed
+        std::vector<std::string> names = listFiles(dir);
+        std::string jobName, claimPath;
+        for (size_t i = 0; i < names.size(); i++) {
+            if (!endsWith(names[i], ".job"))
+                continue;
+            std::string claim = dir + "/" + names[i] + claimSuffix.str();
+            if (rename((dir + "/" + names[i]).c_str(), claim.c_str()) == 0) {
+                // The job file may have waited a while, the claim is fresh
+                utime(claim.c_str(), NULL);
+                jobName = names[i];
+                claimPath = claim;
+                break;
+            }
+        }
+        if (jobName.empty()) {
+            if (!untilDone || fileExists(dir + "/done"))
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            continue;
+        }
+        std::string tileName = jobName.substr(0, jobName.size() - 4);
+        std::string failedPath = dir + "/" + tileName + ".failed";
+        
+        std::vector<std::string> args;
+        std::ifstream file(claimPath.c_str());
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty())
+                args.push_back(line);
+        }
+        Job job;
+        std::string error;
+        if (!parseJob(args, job, error) || !checkJob(job, error) || job.isTransfer() || job.outputPath.empty()) {
+            if (error.empty())
+                error = "Tiles must be synthesis jobs with an --output path.";
+            std::cout << "Tile " << tileName << ": " << error << "\n";
+            rename(claimPath.c_str(), failedPath.c_str());
+            continue;
+        }
+        
+        // Show the coordinator this worker is still alive while it generates
+        std::atomic<bool> working(true);
+        std::thread heartbeat([&] {
+            while (working) {
+                for (int i = 0; i < heartbeatSeconds * 10 && working; i++)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                utime(claimPath.c_str(), NULL);
+            }
+        });
+        
+        if (source == NULL || sourceKey != job.sourceKey() || source->pageReadFailed()) {
+            source.reset(new SourceImage(job.sourcePath.c_str(), job.blockSize, job.borderSize, job.randomness, sourceMemoryBytes(job), job.pixelLayout));
+            source->setErrorMetric(job.metric);
+            sourceKey = job.sourceKey();
+        }
+        if (!source->getError().empty()) {
+            working = false;
+            heartbeat.join();
+            source.reset();
+            rename(claimPath.c_str(), failedPath.c_str());
+            continue;
+        }
+        // Every worker process starts with the same seed, so mix in which process and tile this is
+        srand((unsigned)(time(0) ^ (getpid() << 16) ^ std::hash<std::string>()(tileName)));
+        Texture texture(source.get(), job.width, job.height);
+        texture.setSearch(job.search);
+        // Other worker processes are using the other cores
+        if (job.autoSearch) {
+            CostModel model = loadOrCalibrate(job.tuningPath);
+            applyTuning(tuneTexture(model, source.get(), &texture, 1), source.get(), &texture);
+        }
+        texture.generateTexture();
+        
+        // Written next to the tile and renamed, so the coordinator never reads half a tile
+        std::string extension = job.outputPath.substr(job.outputPath.size() - 4);
+        std::string partPath = job.outputPath.substr(0, job.outputPath.size() - 4) + claimSuffix.str() + extension;
+        bool written = !source->pageReadFailed() && texture.getOutputImage()->writeFile(partPath.c_str()) &&
+            rename(partPath.c_str(), job.outputPath.c_str()) == 0;
+        
+        working = false;
+        heartbeat.join();
+        if (written)
+            unlink(claimPath.c_str());
+        else {
+            unlink(partPath.c_str());
+            rename(claimPath.c_str(), failedPath.c_str());
+        }
+    }
+}
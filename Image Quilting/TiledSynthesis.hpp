@@ -0,0 +1,62 @@
+//
+//  TiledSynthesis.hpp
+//  Image Quilting
+//
+//  Copyright © 2016 Alex Scarlatos. All rights reserved.
+//
+
+#ifndef TiledSynthesis_hpp
+#define TiledSynthesis_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <sys/types.h>
+#include "Image.hpp"
+#include "Job.hpp"
+
+// Synthesizes a large texture as a grid of tiles generated by separate worker processes
+// Each tile is a texture of its own, extended by overlap pixels to the right and top so it overlaps
+// its neighbours, and the tiles are stitched together along minimum error cuts through the overlaps
+//
+// Tiles are handed out through files in a directory, so workers on other machines can help if it is shared:
+//   tile_<row>_<col>.job                 arguments for the tile, one per line, waiting for a worker
+//   tile_<row>_<col>.job.<host>.<pid>    claimed by that worker, which touches it while it works
+//   tile_<row>_<col>.failed              the worker could not generate it
+//   tile_<row>_<col>.qoi                 the finished tile
+//   manifest                             which job the tiles belong to, tiles of any other job are removed
+//   done                                 all tiles are finished, workers should exit
+class TiledSynthesis {
+private:
+    struct Tile {
+        std::string name;
+        int x, y, width, height;
+        int attempts;
+    };
+    
+    Job job;
+    std::string dir, hostName;
+    int overlap;
+    int cols, rows;
+    std::vector<Tile> tiles;
+    // Local worker processes that are still running
+    std::vector<pid_t> workers;
+    
+    std::string path(const std::string &name) const;
+    bool writeTileJob(const Tile &tile);
+    bool retry(Tile &tile, const std::string &from, const char *reason);
+    bool generateTiles();
+    void stitchTile(const Tile &tile, Image *tileImage, Image *outputImage);
+public:
+    TiledSynthesis(const Job &j);
+    // Generate the tiles, stitch them and write the texture to the job's output path
+    // Returns false if a tile kept failing or a file could not be written
+    bool run();
+};
+
+// Generate tiles from dir until there are none left, or until it has a done file if untilDone
+// This is what every worker process runs; other machines can run it with --tile-worker
+void runTileWorker(const std::string &dir, bool untilDone);
+
+#endif /* TiledSynthesis_hpp */
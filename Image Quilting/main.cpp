@@ -15,9 +15,18 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <thread>
 #include "SourceImage.hpp"
 #include "Texture.hpp"
 #include "Image.hpp"
+#include "Job.hpp"
+#include "AutoTuner.hpp"
+#include "Server.hpp"
+#include "TiledSynthesis.hpp"
+#include "SelfCheck.hpp"
 
 
 bool debugging = false;
@@ -26,6 +35,14 @@ SourceImage *sourceImage;
 Image *targetImage = NULL;
 Texture *texture = NULL;
 
+// The job given on the command line
+Job job;
+
+// Window coordinates where the current mouse drag started
+int dragStartX, dragStartY;
+// Height of the window, kept up to date by reshape
+int windowHeight;
+
 // This is for creating the images in debug mode
 void createDebugImages()
 {
@@ -42,6 +59,15 @@ void createDebugImages()
     }
 }
 
+void printUsage()
+{
+    printJobUsage();
+    std::cout << "Server: --serve socket_path [--workers n] [--queue n] [--cache n] [--output-dir dir] [--tuning path]\n";
+    std::cout << "Tile worker for another machine's --tiles job: --tile-worker tile_dir\n";
+    std::cout << "Measure this machine for --search auto: --calibrate [path]\n";
+    std::cout << "Check the synthesis code on the bundled images: --check [images_dir]\n";
+}
+
 // OpenGL function for displaying image
 void display()
 {
@@ -56,12 +82,36 @@ void display()
 // OpenGL function for window resizing
 void reshape(GLint newWidth, GLint newHeight)
 {
+    windowHeight = newHeight;
     glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
     gluOrtho2D(0.0, newWidth, 0.0, newHeight);
     
     glutPostRedisplay();
 }
 
+// OpenGL function for mouse clicks
+// Dragging a rectangle over the texture resynthesizes the blocks under it
+void mouse(GLint button, GLint state, GLint x, GLint y)
+{
+    if (button != GLUT_LEFT_BUTTON || texture == NULL)
+        return;
+    
+    // Window y goes down from the top, texture y goes up from the bottom of the window
+    y = windowHeight - 1 - y;
+    if (state == GLUT_DOWN) {
+        dragStartX = x;
+        dragStartY = y;
+    }
+    else if (state == GLUT_UP) {
+        int step = sourceImage->blockSize - sourceImage->borderSize;
+        int x0 = dragStartX < x ? dragStartX : x, x1 = dragStartX < x ? x : dragStartX;
+        int y0 = dragStartY < y ? dragStartY : y, y1 = dragStartY < y ? y : dragStartY;
+        texture->resynthesizeRegion(x0 / step, y0 / step, x1 / step, y1 / step);
+        glutPostRedisplay();
+    }
+}
+
 int main(int argc, char** argv)
 {
 #ifdef DEBUG
@@ -71,45 +121,131 @@ int main(int argc, char** argv)
     if (debugging)
         createDebugImages();
     else {
+        std::vector<std::string> args(argv + 1, argv + argc);
+        if (args.size() == 1 && args[0] == "-h") {
+            printUsage();
+            exit(0);
+        }
+        
+        // Server mode: serve jobs over a socket instead of running one
+        if (args.size() >= 2 && args[0] == "--serve") {
+            int workers = std::thread::hardware_concurrency(), queueSize = 16, cacheSize = 8;
+            std::string outputDir, tuningPath;
+            for (size_t i = 2; i < args.size(); i += 2) {
+                bool valid = i + 1 < args.size();
+                if (valid && args[i] == "--output-dir")
+                    outputDir = args[i+1];
+                else if (valid && args[i] == "--tuning")
+                    tuningPath = args[i+1];
+                else if (valid && (args[i] == "--workers" || args[i] == "--queue" || args[i] == "--cache")) {
+                    int value = atoi(args[i+1].c_str());
+                    if (value < 1) {
+                        std::cout << args[i] << " has to be a positive number.\n";
+                        exit(-1);
+                    }
+                    (args[i] == "--workers" ? workers : args[i] == "--queue" ? queueSize : cacheSize) = value;
+                }
+                else {
+                    std::cout << (valid ? "Unknown option " + args[i] + ".\n" : args[i] + " needs a value.\n");
+                    printUsage();
+                    exit(-1);
+                }
+            }
+            Server server(args[1].c_str(), workers, queueSize, cacheSize, outputDir, tuningPath);
+            exit(server.run() ? 0 : -1);
+        }
+        
+        // Tile worker mode: help generate the tiles of a job started elsewhere
+        if (args.size() == 2 && args[0] == "--tile-worker") {
+            runTileWorker(args[1], true);
+            exit(0);
+        }
+        
+        // Check mode: run the self checks on the bundled images
+        if ((args.size() == 1 || args.size() == 2) && args[0] == "--check")
+            exit(runSelfChecks(args.size() == 2 ? args[1] : "Images") ? 0 : -1);
+        
+        // Calibration mode: measure this machine for --search auto and save it
+        if ((args.size() == 1 || args.size() == 2) && args[0] == "--calibrate") {
+            std::string path = args.size() == 2 ? args[1] : defaultTuningPath();
+            CostModel model = calibrateCostModel();
+            printCostModel(model);
+            exit(saveCostModel(model, path) ? 0 : -1);
+        }
+        
         // Parse arguments and create classes or exit if necessary
-        if (argc == 2 && strcmp(argv[1], "-h") == 0) {
-            std::cout << "Texture synthesis: source_image_path block_size border_size randomness width height\n";
-            std::cout << "Texture transfer: source_image_path block_size border_size randomness target_image_path\n";
+        std::string error;
+        if (!parseJob(args, job, error) || !checkJob(job, error)) {
+            std::cout << error << "\n";
+            printUsage();
             exit(0);
         }
-        // args for synthesis: executable sourceImage blockSize borderSize randomness width height
-        else if (argc == 7) {
-            sourceImage = new SourceImage(argv[1], atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
-            texture = new Texture(sourceImage, atoi(argv[5]), atoi(argv[6]));
+        
+        // Tiled synthesis writes the texture without showing it
+        if (job.isTiled()) {
+            TiledSynthesis tiled(job);
+            exit(tiled.run() ? 0 : -1);
         }
-        // args for transfer: executable sourceImage blockSize borderSize randomness targetImage
-        else if (argc == 6) {
-            sourceImage = new SourceImage(argv[1], atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
-            targetImage = new Image(argv[5]);
+        sourceImage = new SourceImage(job.sourcePath.c_str(), job.blockSize, job.borderSize, job.randomness, sourceMemoryBytes(job), job.pixelLayout);
+        if (!sourceImage->getError().empty())
+            exit(-1);
+        sourceImage->setErrorMetric(job.metric);
+        if (job.isTransfer()) {
+            targetImage = new Image(job.targetPath.c_str());
+            if (!targetImage->getReadError().empty())
+                exit(-1);
             texture = new Texture(sourceImage, targetImage);
         }
-        else {
-            std::cout << "Invalid number of arguments.\n";
-            std::cout << "Texture synthesis: source_image_path block_size border_size randomness width height\n";
-            std::cout << "Texture transfer: source_image_path block_size border_size randomness target_image_path\n";
-            exit(0);
+        else
+            texture = new Texture(sourceImage, job.width, job.height, job.tileable);
+        texture->setSearch(job.search);
+        texture->setDeadline(job.deadline);
+        if (job.autoSearch && job.loadLayoutPath.empty()) {
+            CostModel model = loadOrCalibrate(job.tuningPath);
+            applyTuning(tuneTexture(model, sourceImage, texture, model.hardwareThreads), sourceImage, texture);
         }
     }
     
-    // Generate the texture
-    texture->generateTexture();
+    // Textures are written as the blocks covering their rows are placed
+    ImageWriter *writer = NULL;
+    if (!job.outputPath.empty()) {
+        writer = createImageWriter(texture->getOutputImage()->view(), job.outputPath.c_str());
+        if (writer == NULL)
+            exit(-1);
+        texture->setWriter(writer);
+    }
+    
+    // Generate the texture, or recreate it from a saved layout
+    if (!job.loadLayoutPath.empty()) {
+        if (!texture->loadLayout(job.loadLayoutPath.c_str()))
+            exit(-1);
+    }
+    else
+        texture->generateTexture();
+    sourceImage->printMemoryReport();
+    if (sourceImage->pageReadFailed())
+        exit(-1);
+    
+    if (!job.saveLayoutPath.empty() && !texture->saveLayout(job.saveLayoutPath.c_str()))
+        exit(-1);
+    
+    // Write the texture instead of showing it
+    if (writer != NULL)
+        exit(writer->write() ? 0 : -1);
     
     // Set up openGL, which will render the texture
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
     glutInitWindowPosition(100, 100);
     glutInitWindowSize(texture->getWidth(), texture->getHeight());
+    windowHeight = texture->getHeight();
     glutCreateWindow("Image Quilting");
     glClearColor(1.0, 1.0, 1.0, 0.0);   // White display window
     glClear(GL_COLOR_BUFFER_BIT);
     
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
+    glutMouseFunc(mouse);
     
     glutMainLoop();
 }